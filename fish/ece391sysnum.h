@@ -11,5 +11,9 @@
 #define SYS_VIDMAP  8
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
+#define SYS_NICE    11
+#define SYS_SLEEP   12
+#define SYS_POLL    13
+#define SYS_IOCTL   14
 
 #endif /* ECE391SYSNUM_H */
@@ -3,6 +3,7 @@
  */
 
 #include "keyboard.h"
+#include "keymap.h"
 #include "pit.h"
 #include "../i8259.h"
 #include "../isr.h"
@@ -12,113 +13,38 @@
 #include "../sys_calls.h"
 #include "../virtualmem.h"
 #include "../x86_desc.h"
+#include "../timer.h"
+#include "../physmem.h"
 
-static int32_t terminal_open(const uint8_t* filename);
+static int32_t terminal_open(int32_t fd, const uint8_t* filename);
 static int32_t terminal_close(int32_t fd);
 static int32_t terminal_read(int32_t fd, void* buf, int32_t nbytes);
 static int32_t terminal_write(int32_t fd, const void* buf, int32_t nbytes);
-
-// Scancode for keyboard keys
-// Source: http://www.brokenthorn.com/Resources/OSDev19.html
-static uint16_t kybd_keys [] = {
-
-	KEY_UNKNOWN,	//0
-	KEY_ESCAPE,		//1
-	KEY_1,			//2
-	KEY_2,			//3
-	KEY_3,			//4
-	KEY_4,			//5
-	KEY_5,			//6
-	KEY_6,			//7
-	KEY_7,			//8
-	KEY_8,			//9
-	KEY_9,			//0xa
-	KEY_0,			//0xb
-	KEY_MINUS,		//0xc
-	KEY_EQUAL,		//0xd
-	KEY_BACKSPACE,	//0xe
-	KEY_TAB,		//0xf
-	KEY_Q,			//0x10
-	KEY_W,			//0x11
-	KEY_E,			//0x12
-	KEY_R,			//0x13
-	KEY_T,			//0x14
-	KEY_Y,			//0x15
-	KEY_U,			//0x16
-	KEY_I,			//0x17
-	KEY_O,			//0x18
-	KEY_P,			//0x19
-	KEY_LEFTBRACKET,//0x1a
-	KEY_RIGHTBRACKET,//0x1b
-	KEY_RETURN,		//0x1c
-	KEY_LCTRL,		//0x1d
-	KEY_A,			//0x1e
-	KEY_S,			//0x1f
-	KEY_D,			//0x20
-	KEY_F,			//0x21
-	KEY_G,			//0x22
-	KEY_H,			//0x23
-	KEY_J,			//0x24
-	KEY_K,			//0x25
-	KEY_L,			//0x26
-	KEY_SEMICOLON,	//0x27
-	KEY_QUOTE,		//0x28
-	KEY_GRAVE,		//0x29
-	KEY_LSHIFT,		//0x2a
-	KEY_BACKSLASH,	//0x2b
-	KEY_Z,			//0x2c
-	KEY_X,			//0x2d
-	KEY_C,			//0x2e
-	KEY_V,			//0x2f
-	KEY_B,			//0x30
-	KEY_N,			//0x31
-	KEY_M,			//0x32
-	KEY_COMMA,		//0x33
-	KEY_DOT,		//0x34
-	KEY_SLASH,		//0x35
-	KEY_RSHIFT,		//0x36
-	KEY_KP_ASTERISK,//0x37
-	KEY_RALT,		//0x38
-	KEY_SPACE,		//0x39
-	KEY_CAPSLOCK,	//0x3a
-	KEY_F1,			//0x3b
-	KEY_F2,			//0x3c
-	KEY_F3,			//0x3d
-	KEY_F4,			//0x3e
-	KEY_F5,			//0x3f
-	KEY_F6,			//0x40
-	KEY_F7,			//0x41
-	KEY_F8,			//0x42
-	KEY_F9,			//0x43
-	KEY_F10,		//0x44
-	KEY_KP_NUMLOCK,	//0x45
-	KEY_SCROLLLOCK,	//0x46
-	KEY_HOME,		//0x47
-	KEY_KP_8,		//0x48	//keypad up arrow
-	KEY_PAGEUP,		//0x49
-	KEY_KP_2,		//0x50	//keypad down arrow
-	KEY_KP_3,		//0x51	//keypad page down
-	KEY_KP_0,		//0x52	//keypad insert key
-	KEY_KP_DECIMAL,	//0x53	//keypad delete key
-	KEY_UNKNOWN,	//0x54
-	KEY_UNKNOWN,	//0x55
-	KEY_UNKNOWN,	//0x56
-	KEY_F11,		//0x57
-	KEY_F12			//0x58
-};
+static int32_t terminal_poll(int32_t fd, poll_table_t* table);
+static int32_t terminal_ioctl(int32_t fd, int32_t cmd, int32_t arg);
+static void flush_terminal(void * data);
+static int32_t key_command(uint16_t key);
 
 static terminal_t terminals[MAX_TERMINALS];
 
-/* determine if the key is pressed */
-static int r_shift_key = 0;
-static int l_shift_key = 0;
-static int r_ctrl_key = 0;
-static int l_ctrl_key = 0;
-static int r_alt_key = 0;
-static int l_alt_key = 0;
+/* rows that scrolled off the terminals */
+static history_t histories[MAX_TERMINALS];
+
+/* the screens of the terminals, a page each so vidmap can map one */
+static uint16_t term_cells[MAX_TERMINALS][PAGE_SIZE / 2] __attribute__((aligned (PAGE_SIZE)));
+
+/* copies the screen on display to VGA memory at the next tick */
+static timer_t flush_timer;
+
+/* the layout keys are decoded with */
+static const keymap_t * keymap = &keymaps[KEYMAP_US];
 
-/* determine if the key is on */
-static int caps_lock = 0;
+/* MOD_* bits of the modifiers held down and caps lock */
+static uint8_t mods = 0;
+/* the next scancode follows an extended prefix */
+static uint8_t extended = 0;
+/* bytes of a Pause sequence still to come */
+static uint8_t skip = 0;
 
 static int32_t current_terminal = -1;
 
@@ -126,7 +52,9 @@ static fops_t term_fops = {
 	.read = terminal_read,
 	.write = terminal_write,
 	.open = terminal_open,
-	.close = terminal_close
+	.close = terminal_close,
+	.poll = terminal_poll,
+	.ioctl = terminal_ioctl
 };
 
 /* terminal_open
@@ -137,7 +65,7 @@ static fops_t term_fops = {
  * RETURN: 0
  * SIDE EFFECTS: None
  */
-int32_t terminal_open(const uint8_t* filename){
+int32_t terminal_open(int32_t fd, const uint8_t* filename){
   return 0;
 }
 
@@ -147,62 +75,136 @@ int32_t terminal_open(const uint8_t* filename){
  * INPUT: None - none of the parameters are used
  * OUTPUT: None
  * RETURN: 0
- * SIDE EFFECTS: None
+ * SIDE EFFECTS: Puts the terminal back in cooked mode when the process that
+ * 			 made it raw halts, and stops refreshing the screen for a
+ * 			 halting vidmap program
  */
 int32_t terminal_close(int32_t fd){
-  return 0;
+	pcb_t * pcb;
+	terminal_t * term;
+
+	pcb(pcb);
+	term = &terminals[pcb -> term_num];
+
+	if(fd == 0 && term -> raw_owner == pcb) {
+		term -> mode = TERM_COOKED;
+		term -> raw_owner = NULL;
+	}
+	if(fd == 0 && term -> vidmap_owner == pcb)
+		term -> vidmap_owner = NULL;
+	return 0;
 }
 
 /* terminal_read
  * DESC: returns data from one line that has been terminated by pressing
- * Enter, or as much as fits in the buffer from one such line
+ * Enter, or as much as fits in the buffer from one such line. In raw mode
+ * it returns the keys pressed so far instead. On a non-blocking fd it
+ * returns 0 when there is nothing to read yet
  * INPUT: The current terminal buffer from the curent pcb, number of bytes to read
- * OUTPUT: Moves nbytes number of bytes from terminal buffer to the passed in buffer
+ * OUTPUT: Moves nbytes number of bytes from the terminal's input ring to the
+ * passed in buffer
  * RETURN: Number of bytes read from the terminal buffer
- * SIDE EFFECTS: Moves the unread bytes to the beginning of the buffer and
- * clears the rest of the buffer
+ * SIDE EFFECTS: Bytes not read stay in the ring for the next read
  */
 int32_t terminal_read(int32_t fd, void* buf, int32_t nbytes){
-	int diff, chars_read;
 	pcb_t * pcb;
-	int32_t term_num;
+	terminal_t * term;
+	uint32_t tail, end, flags;
+	int32_t count = 0;
+	uint8_t c;
 
 	/* Check for null pointer */
 	if(buf == NULL)
 		return -1;
 
 	pcb(pcb);
-	term_num = pcb -> term_num;
+	term = &terminals[pcb -> term_num];
+
+	/* sleep until user hit enter, only sleeping needs interrupts off */
+	if(term -> tail == term -> commit) {
+		if(pcb -> files[fd].flags & FD_NONBLOCK)
+			return 0;
+
+		cli_and_save(flags);
+		while(term -> tail == term -> commit)
+			sleep_on(&term -> read_wait);
+		restore_flags(flags);
+	}
+
+	/* the interrupt handler only adds bytes before commit */
+	tail = term -> tail;
+	end = term -> commit;
+	barrier();
+
+	while(count < nbytes && tail != end) {
+		c = term -> input[tail++ & INPUT_RING_MASK];
+		((uint8_t *) buf)[count++] = c;
+		if(c == '\n' && term -> mode == TERM_COOKED)
+			break;
+	}
+
+	/* hand the space back after the bytes have been copied */
+	barrier();
+	term -> tail = tail;
+
+	return count;
+}
+
+/* terminal_poll
+ * DESC: Reports whether input is ready to be read from the terminal of the
+ * current process: a whole line, or in raw mode any key
+ * INPUT: fd - unused, table - poll table to wait on for more input
+ * OUTPUT: None
+ * RETURN: POLLOUT, and POLLIN if there is input to read
+ * SIDE EFFECTS: Adds the process to the read wait queue of its terminal
+ */
+int32_t terminal_poll(int32_t fd, poll_table_t* table){
+	pcb_t * pcb;
+	terminal_t * term;
+
+	pcb(pcb);
+	term = &terminals[pcb -> term_num];
 
-	/* wait until user hit enter */
-	terminals[term_num].reading = 1;
-	terminals[term_num].hit_enter = 0;
+	poll_wait(table, &term -> read_wait);
 
-	while(!terminals[term_num].hit_enter);
+	return term -> tail != term -> commit ? POLLIN | POLLOUT : POLLOUT;
+}
 
-	cli();
+/* terminal_ioctl
+ * DESC: Switches the terminal of the current process between cooked mode,
+ * where reads return whole edited lines, and raw mode, where reads return
+ * every key as it is pressed without echoing it. Also selects the keyboard
+ * layout, which all terminals share
+ * INPUT: fd - unused, cmd - IOCTL_TERM_MODE or IOCTL_KEYMAP,
+ * arg - TERM_COOKED or TERM_RAW, or one of the KEYMAP_* layouts
+ * OUTPUT: None
+ * RETURN: 0 on success, -1 for an unknown command, mode or layout
+ * SIDE EFFECTS: A line being edited becomes readable when switching to raw
+ */
+int32_t terminal_ioctl(int32_t fd, int32_t cmd, int32_t arg){
+	pcb_t * pcb;
+	terminal_t * term;
+	uint32_t flags;
 
-	/* sanity check on nbytes */
-	if(nbytes > LINE_BUF_MAX) nbytes = LINE_BUF_MAX;
+	if(cmd == IOCTL_KEYMAP) {
+		if(arg < 0 || arg >= NUM_KEYMAPS) return -1;
+		keymap = &keymaps[arg];
+		return 0;
+	}
 
-	/* read nbytes from line buffer */
-	diff = terminals[term_num].buf_count - nbytes;
-	chars_read = nbytes > terminals[term_num].buf_count ?
-			terminals[term_num].buf_count : nbytes;
-	if(diff < 0) diff = 0;
-	memcpy(buf, terminals[term_num].line_buf, nbytes);
+	if(cmd != IOCTL_TERM_MODE || (arg != TERM_COOKED && arg != TERM_RAW))
+		return -1;
 
-	/* move unread bytes in line buffer to beginning */
-	memmove(terminals[term_num].line_buf, terminals[term_num].line_buf + nbytes, diff);
-	/* clear rest of line buffer */
-	memset(terminals[term_num].line_buf + diff, NULL_CHAR, nbytes);
-	terminals[term_num].buf_count = diff;
+	pcb(pcb);
+	term = &terminals[pcb -> term_num];
 
-	sti();
+	cli_and_save(flags);
+	term -> mode = arg;
+	term -> raw_owner = (arg == TERM_RAW) ? pcb : NULL;
+	if(arg == TERM_RAW) term -> commit = term -> head;
+	restore_flags(flags);
 
-	terminals[term_num].reading = 0;
-	terminals[term_num].hit_enter = 0;
-	return chars_read;
+	return 0;
 }
 
 /* terminal_write
@@ -214,7 +216,6 @@ int32_t terminal_read(int32_t fd, void* buf, int32_t nbytes){
  * SIDE EFFECTS: Could move the terminal up
  */
 int32_t terminal_write(int32_t fd, const void* buf, int32_t nbytes){
-	int i;
 	pcb_t * pcb;
 	int32_t term_num;
 
@@ -225,12 +226,10 @@ int32_t terminal_write(int32_t fd, const void* buf, int32_t nbytes){
 	pcb(pcb);
 	term_num = pcb -> term_num;
 
-	for(i = 0; i < nbytes; i++){
-		putc_in_terminal(((int8_t *) buf)[i], &(terminals[term_num].screen));
-	}
-	if(pcb -> term_num == current_terminal) {
-		move_cursor(term_num, &(terminals[term_num].screen), PAGE_SIZE);
-	}
+	/* the screen is in RAM, the display catches up at the next tick */
+	write_in_terminal(buf, nbytes, &(terminals[term_num].screen));
+	if(term_num == current_terminal)
+		request_flush();
 
 	return nbytes;
 }
@@ -238,14 +237,17 @@ int32_t terminal_write(int32_t fd, const void* buf, int32_t nbytes){
 /* kybd_init
  * DESC: Initializes the keyboard interrupt handler which takes inputs from
  * the keyboard and starts all of the terminals
- * INPUT: The keyboard handler
+ * INPUT: scrollback - rows of output each terminal keeps after they scroll
+ * 			 off the screen
  * OUTPUT: Sets the IDT entry for keyboard
  * RETURN: None
  * SIDE EFFECTS: Initializes all of the terminals to position (0,0) and
- * all of the buffers are full of null characters
+ * all of the buffers are full of null characters. Takes the pages for the
+ * scrollback from the frame allocator
  */
-void kybd_init(){
+void kybd_init(uint32_t scrollback){
 	int i;
+	uint32_t j, pages;
 
 	/* Populate IDT entry for keyboard */
 	add_irq(KEYBOARD_IRQ_NUM, (uint32_t) keyboard_handler_main);
@@ -255,14 +257,35 @@ void kybd_init(){
 
 	/* Set all of the values in the line buffer to the null character */
 	for(i = 0; i < MAX_TERMINALS; i++) {
-		memset(terminals[i].line_buf, NULL_CHAR, LINE_BUF_MAX);
-		terminals[i].buf_count = 0;
-		terminals[i].reading = 0;
-		terminals[i].screen.x = 0;
-		terminals[i].screen.y = 0;
-		terminals[i].screen.video_mem = get_video_mem();
+		terminals[i].head = terminals[i].commit = terminals[i].tail = 0;
+		init_wait_queue(&terminals[i].read_wait);
+		terminals[i].mode = TERM_COOKED;
+		terminals[i].raw_owner = NULL;
+		terminals[i].vidmap_owner = NULL;
+		terminals[i].screen.video_mem = (char *) term_cells[i];
+		terminals[i].screen.dirty = 0;
+		terminals[i].screen.scrolled = 0;
+		terminals[i].screen.view = 0;
+		clear_terminal(&(terminals[i].screen));
+		map_user_vidmem(i, (uint32_t) term_cells[i]);
+	}
+
+	/* the history is kept in whole pages, a terminal that gets none has
+	   no scrollback */
+	pages = (scrollback + HISTORY_PAGE_ROWS - 1) / HISTORY_PAGE_ROWS;
+	if(pages > HISTORY_MAX_PAGES) pages = HISTORY_MAX_PAGES;
+	for(i = 0; i < MAX_TERMINALS; i++) {
+		for(j = 0; j < pages; j++) {
+			histories[i].pages[j] = (uint16_t *) alloc_frame();
+			if(histories[i].pages[j] == NULL) break;
+		}
+		histories[i].size = j * HISTORY_PAGE_ROWS;
+		histories[i].head = 0;
+		terminals[i].screen.history = j ? &histories[i] : NULL;
 	}
 
+	timer_setup(&flush_timer, flush_terminal, NULL);
+
 	add_device(TERM_FTYPE, &term_fops);
 }
 
@@ -276,52 +299,60 @@ void kybd_init(){
  */
 void update(uint16_t key){
 	terminal_t * curr_term = &(terminals[current_terminal]);
+	uint32_t head = curr_term -> head;
 
-	if(key == KEY_RETURN){
-		curr_term -> screen.video_mem += PAGE_SIZE * (current_terminal + 1);
-		/* put '/r' as the last character in the buffer */
-		putc_in_terminal(key, &(curr_term -> screen));
-		curr_term -> screen.video_mem -= PAGE_SIZE * (current_terminal + 1);
-		/* Moves the cursor to the next line start at x position 0 */
-		move_cursor(current_terminal, &(curr_term -> screen), PAGE_SIZE);
-		curr_term -> line_buf[curr_term -> buf_count++] = '\n';
-		curr_term -> hit_enter = 1;
-		curr_term -> input_len = 0;
-		/* If the terminal is not being read from then just clear the terminal buffer */
-		if(!curr_term -> reading) {
-			memset(curr_term -> line_buf, NULL_CHAR, LINE_BUF_MAX);
-			curr_term -> buf_count = 0;
+	/* typing brings the display back from the history */
+	if(curr_term -> screen.view) {
+		scroll_view(&(curr_term -> screen), -curr_term -> screen.view);
+		request_flush();
+	}
+
+	/* raw mode hands every key to the reader, dropping it if the ring is full */
+	if(curr_term -> mode == TERM_RAW){
+		if(head - curr_term -> tail < INPUT_RING_SIZE) {
+			curr_term -> input[head++ & INPUT_RING_MASK] = (key == KEY_RETURN) ? '\n' : key;
+			barrier();
+			curr_term -> head = curr_term -> commit = head;
+			wake_up_interactive(&curr_term -> read_wait);
+		}
+	}
+	/* typing leaves room for the newline, so a line can be finished unless
+	 * the ring is full of lines nobody has read */
+	else if(key == KEY_RETURN){
+		if(head - curr_term -> tail < INPUT_RING_SIZE) {
+			/* put '/r' as the last character in the buffer */
+			putc_in_terminal(key, &(curr_term -> screen));
+			request_flush();
+			curr_term -> input[head++ & INPUT_RING_MASK] = '\n';
+			barrier();
+			curr_term -> head = curr_term -> commit = head;
+			wake_up_interactive(&curr_term -> read_wait);
 		}
 	}
 	/* If backspace is pressed then delete the character from the screen and
-		 delete the character from the terminal buffer */
+		 delete the character from the line being edited */
 	else if(key == KEY_BACKSPACE){
-		if(curr_term -> input_len){
-			curr_term -> screen.video_mem += PAGE_SIZE * (current_terminal + 1);
+		if(head != curr_term -> commit){
 			backspace_fnc(&(curr_term -> screen));
-			curr_term -> screen.video_mem -= PAGE_SIZE * (current_terminal + 1);
-			move_cursor(current_terminal, &(curr_term -> screen), PAGE_SIZE);
-			curr_term -> buf_count--;
-			curr_term -> input_len--;
-			curr_term -> line_buf[curr_term -> buf_count] = NULL_CHAR;
+			request_flush();
+			curr_term -> head = head - 1;
 		}
 	}
-	/* If the terminal buffer is already full then do not print anything and
+	/* If the line or the ring is already full then do not print anything and
 		 stop filling the buffer */
-	else if(curr_term -> buf_count < LINE_BUF_MAX - 1 - 1){  /* make room for newline at end */
-		curr_term -> screen.video_mem += PAGE_SIZE * (current_terminal + 1);
+	else if(head - curr_term -> commit < LINE_BUF_MAX - 1 &&
+			head - curr_term -> tail < INPUT_RING_SIZE - 1){  /* make room for newline at end */
 		putc_in_terminal(key, &(curr_term -> screen));
-		curr_term -> screen.video_mem -= PAGE_SIZE * (current_terminal + 1);
-		move_cursor(current_terminal, &(curr_term -> screen), PAGE_SIZE);
-		curr_term -> line_buf[curr_term -> buf_count] = key;
-		curr_term -> buf_count++;
-		curr_term -> input_len++;
+		request_flush();
+		curr_term -> input[head & INPUT_RING_MASK] = key;
+		curr_term -> head = head + 1;
 	}
 }
 
 /* keyboard_handler_main
  * DESC: Keyboard interrupt function that gets the key pressed from the keyboard
- * and determines what to do with it
+ * and determines what to do with it. A key is decoded with one lookup in the
+ * plane of the keymap its modifiers select
  * INPUT: The keyboard data from the keyboard ports
  * OUTPUT: None
  * RETURN: None
@@ -329,128 +360,85 @@ void update(uint16_t key){
  * between terminals
  */
 void keyboard_handler_main(){
+	uint8_t scancode, code, ext;
+	uint16_t key;
 
-	unsigned char scancode;
-	unsigned char status;
-	int i;
-
-	status = inb(KEYBOARD_PORT);
-	if(status & 1){
+	if(inb(KEYBOARD_PORT) & 1){
 		/* Read from keyboard's data buffer */
 		scancode = inb(KEYBOARD_PORT_DATA);
-		uint16_t key_out;
-
-		if((scancode & MASK_KEY_PRESS)){ //0x80 is a flag for key release check
-			scancode -= MASK_KEY_PRESS; // Get the actual scancode value
-			key_out = kybd_keys[scancode];
-			if(key_out == KEY_RSHIFT) r_shift_key = 0;
-			else if(key_out == KEY_LSHIFT) l_shift_key = 0;
-			else if(key_out == KEY_LCTRL) r_ctrl_key = 0;
-			else if(key_out == KEY_RCTRL) l_ctrl_key = 0;
-			else if(key_out == KEY_LALT) l_alt_key = 0;
-			else if(key_out == KEY_RALT) r_alt_key = 0;
-		}
-		/* If key not released, print to screen */
-		else if(!(scancode & MASK_KEY_PRESS)){ //0x80 is a flag for key release check
-			key_out = kybd_keys[scancode];
-			int shift = l_shift_key | r_shift_key;
-			int alt = l_alt_key | r_alt_key;
-			int ctrl = l_ctrl_key | r_ctrl_key;
-			if(key_out == KEY_CAPSLOCK) caps_lock = !caps_lock;
-			else if(key_out == KEY_RSHIFT) r_shift_key = 1;
-			else if(key_out == KEY_LSHIFT) l_shift_key = 1;
-			else if(key_out == KEY_LCTRL) r_ctrl_key = 1;
-			else if(key_out == KEY_RCTRL) l_ctrl_key = 1;
-			else if(key_out == KEY_LALT) l_alt_key = 1;
-			else if(key_out == KEY_RALT) r_alt_key = 1;
-			else{
-				if(!shift && ctrl && key_out == 'l') {
-					terminals[current_terminal].screen.video_mem += PAGE_SIZE * (current_terminal + 1);
-					clear_terminal(&(terminals[current_terminal].screen));
-					for(i = 0; i < terminals[current_terminal].buf_count; i++){
-						putc_in_terminal(((int8_t *) terminals[current_terminal].line_buf)[i],
-							&(terminals[current_terminal].screen)
-						);
-					}
-					terminals[current_terminal].screen.video_mem -= PAGE_SIZE * (current_terminal + 1);
-					move_cursor(current_terminal, &(terminals[current_terminal].screen), PAGE_SIZE);
-				}
-				else if(!ctrl && !shift && alt && key_out == KEY_F1) {
-					send_eoi(KEYBOARD_IRQ_NUM);
-					start_terminal(0);
-					return;
-				}
-				else if(!ctrl && !shift && alt && key_out == KEY_F2) {
-					send_eoi(KEYBOARD_IRQ_NUM);
-					start_terminal(1);
-					return;
-				}
-				else if(!ctrl && !shift && alt && key_out == KEY_F3) {
-					send_eoi(KEYBOARD_IRQ_NUM);
-					start_terminal(2);
-					return;
-				}
-				else if(scancode > MAX_SCANCODE){} //If not valid scancode do nothing
-				else{
-					if((caps_lock ^ shift) && (!alt && !ctrl)
-							&& (key_out >= 'a' && key_out <= 'z'))
-						key_out -= 'a' - 'A';  /* offset for capital chars */
-					else if(shift && !ctrl && !alt) {
-						switch(key_out) {
-							case '0': key_out = KEY_RIGHTPARENTHESIS;
-								break;
-							case '1': key_out = KEY_EXCLAMATION;
-								break;
-							case '2': key_out = KEY_AT;
-								break;
-							case '3': key_out = KEY_HASH;
-								break;
-							case '4': key_out = KEY_DOLLAR;
-								break;
-							case '5': key_out = KEY_PERCENT;
-								break;
-							case '6': key_out = KEY_CARRET;
-								break;
-							case '7': key_out = KEY_AMPERSAND;
-								break;
-							case '8': key_out = KEY_ASTERISK;
-								break;
-							case '9': key_out = KEY_LEFTPARENTHESIS;
-								break;
-							case KEY_COMMA: key_out = KEY_LESS;
-								break;
-							case KEY_DOT: key_out = KEY_GREATER;
-								break;
-							case KEY_SLASH: key_out = KEY_QUESTION;
-								break;
-							case KEY_SEMICOLON: key_out = KEY_COLON;
-								break;
-							case KEY_QUOTE: key_out = KEY_QUOTEDOUBLE;
-								break;
-							case KEY_LEFTBRACKET: key_out = KEY_LEFTCURL;
-								break;
-							case KEY_RIGHTBRACKET: key_out = KEY_RIGHTCURL;
-								break;
-							case KEY_GRAVE: key_out = KEY_TILDE;
-								break;
-							case KEY_MINUS: key_out = KEY_UNDERSCORE;
-								break;
-							case KEY_EQUAL: key_out = KEY_PLUS;
-								break;
-							case KEY_BACKSLASH: key_out = KEY_BAR;
-								break;
-						}
-					}
-					/* if the key is not supposed to print to screen then ignore it */
-					if((key_out >= ' ' && key_out <= '~') ||
-							(key_out == KEY_BACKSPACE) ||
-							(key_out == KEY_RETURN))
-						update(key_out);
-			  }
-			}
+		code = scancode & ~MASK_KEY_PRESS;
+		ext = extended;
+		extended = 0;
+
+		if(skip)
+			skip--;
+		else if(scancode == SCANCODE_EXTENDED)
+			extended = 1;
+		else if(scancode == SCANCODE_PAUSE)
+			skip = PAUSE_SKIP;
+		else if(scancode & MASK_KEY_PRESS)
+			mods &= ~keymap_mods[ext][code];
+		else {
+			mods |= keymap_mods[ext][code];
+
+			/* commands are named by the key without shift */
+			if(ext)
+				key = keymap -> planes[PLANE_EXTENDED][code];
+			else if(mods & (MOD_CTRL | MOD_ALT))
+				key = keymap -> planes[PLANE_NONE][code];
+			else
+				key = keymap -> planes[keymap_plane[mods & MOD_PLANE_MASK]][code];
+
+			if(key != KEY_UNKNOWN && key <= KEY_CHAR_MAX && !(mods & (MOD_CTRL | MOD_ALT)))
+				update(key);
+			else if(key_command(key))
+				return;
 		}
 	}
 	send_eoi(KEYBOARD_IRQ_NUM);
+
+	/* let a reader woken by this key echo it right away */
+	preempt_check();
+}
+
+/* key_command
+ * DESC: Carries out a key that is not typed into the terminal: caps lock,
+ * Ctrl-L, scrolling through the history and switching terminals
+ * INPUT: key - the key pressed, as it is without shift for Ctrl and Alt
+ * OUTPUT: None
+ * RETURN: 1 if it switched terminals, which acknowledges the interrupt,
+ * 0 otherwise
+ * SIDE EFFECTS: May switch terminals
+ */
+static int32_t key_command(uint16_t key){
+	uint8_t shift = mods & MOD_SHIFT, ctrl = mods & MOD_CTRL, alt = mods & MOD_ALT;
+	terminal_t * term = &terminals[current_terminal];
+	uint32_t i;
+
+	if(key == KEY_CAPSLOCK)
+		mods ^= MOD_CAPS;
+	else if(!shift && ctrl && !alt && key == KEY_L) {
+		clear_terminal(&(term -> screen));
+		/* reprint the line being edited */
+		for(i = term -> commit; i != term -> head; i++)
+			putc_in_terminal(term -> input[i & INPUT_RING_MASK], &(term -> screen));
+		request_flush();
+	}
+	else if(shift && !ctrl && !alt && key == KEY_PAGEUP) {
+		scroll_view(&(term -> screen), SCROLL_STEP);
+		request_flush();
+	}
+	else if(shift && !ctrl && !alt && key == KEY_PAGEDOWN) {
+		scroll_view(&(term -> screen), -SCROLL_STEP);
+		request_flush();
+	}
+	else if(!shift && !ctrl && alt && key >= KEY_F1 && key < KEY_F1 + MAX_TERMINALS) {
+		/* the switch may not come back to this interrupt */
+		send_eoi(KEYBOARD_IRQ_NUM);
+		start_terminal(key - KEY_F1);
+		return 1;
+	}
+	return 0;
 }
 
 /* start_terminal
@@ -473,28 +461,67 @@ int32_t start_terminal(uint32_t term_num){
 
 	if(!free_procs() && next_active_process == -1) return -1;
 
-	set_vga_start(term_num * PAGE_SIZE);
-
-	move_cursor(term_num, &(terminals[term_num].screen), PAGE_SIZE);
+	/* the new screen is drawn whole right away */
+	show_screen(&(terminals[term_num].screen));
 
 	/* switch processes */
 	current_terminal = term_num;
+	if(terminals[term_num].vidmap_owner != NULL)
+		request_flush();
 	if(next_active_process == -1){
 		/* terminal not initialized */
 		/* start shell in terminal */
-		uint8_t shell[] = "shell";
-
 		if(curr_active_process != -1) {
-			schedule_for_execution(shell);
+			schedule_for_execution((uint8_t *) "shell", term_num);
 		} else {
 			while(1)
-				execute(shell);
+				execute_on_terminal((uint8_t *) "shell", term_num);
 		}
 	}
 
 	return 0;
 }
 
+/* request_flush
+ * DESC: Makes the display show the changes to the screen of the terminal on
+ * display at the next timer tick, so a burst of output reaches VGA memory once
+ * INPUT: None
+ * OUTPUT: None
+ * RETURN: None
+ * SIDE EFFECTS: Starts the flush timer if it is not running
+ */
+void request_flush(){
+	uint32_t flags;
+
+	cli_and_save(flags);
+	if(!timer_pending(&flush_timer))
+		timer_add(&flush_timer, 1, 0);
+	restore_flags(flags);
+}
+
+/* flush_terminal
+ * DESC: Timer callback that copies the changed rows of the terminal on
+ * display to VGA memory. A program drawing to its screen through vidmap does
+ * not say when it changes it, so that screen is compared with the display at
+ * every tick
+ * INPUT: data - unused
+ * OUTPUT: Updates the display
+ * RETURN: None
+ * SIDE EFFECTS: Restarts the flush timer for vidmap programs
+ */
+static void flush_terminal(void * data){
+	terminal_t * term;
+
+	if(current_terminal < 0) return;
+	term = &terminals[current_terminal];
+
+	if(term -> vidmap_owner != NULL) {
+		touch_screen(&(term -> screen));
+		timer_add(&flush_timer, 1, 0);
+	}
+	flush_screen(&(term -> screen));
+}
+
 /* set_curr_active_process
  * DESC: Set the active process of the current terminal
  * INPUT: The identification number of the active process
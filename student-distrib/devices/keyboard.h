@@ -7,6 +7,7 @@
 
 #include "../types.h"
 #include "../lib.h"
+#include "../sched.h"
 
 #define KEYBOARD_PORT     0x64
 #define KEYBOARD_PORT_DATA 0x60
@@ -14,8 +15,14 @@
 #define KEYBOARD_DISABLE  0xAD
 #define KEYBOARD_IRQ_NUM  0x01
 #define MASK_KEY_PRESS    0x80
-#define MAX_SCANCODE      0x3A
+#define KEY_CHAR_MAX      0x7F  /* keys up to this are typed into the terminal */
 #define LINE_BUF_MAX      128
+#define INPUT_RING_SIZE   256  /* power of 2 */
+#define INPUT_RING_MASK   (INPUT_RING_SIZE - 1)
+
+/* terminal input modes */
+#define TERM_COOKED       0  /* reads return edited, echoed lines */
+#define TERM_RAW          1  /* reads return keys as they are pressed */
 #define NULL_CHAR         '\0'
 // Scancode for keyboard keys
 // Source: http://www.brokenthorn.com/Resources/OSDev19.html
@@ -170,17 +177,29 @@
 
 #define MAX_TERMINALS		  3
 
+/* rows Shift+PageUp and Shift+PageDown move the display by */
+#define SCROLL_STEP			  12
+
+/* rows of scrollback when the boot command line does not set them */
+#define SCROLLBACK_DEFAULT	  500
+
 typedef struct {
 	screen_t screen;
-	int8_t line_buf[LINE_BUF_MAX];
-	uint16_t buf_count;
-	int32_t input_len;
-	int8_t hit_enter;
-	int8_t reading;
+	/* keyboard input, a single producer single consumer ring. The
+	 * keyboard interrupt appends at head and moves commit past each
+	 * finished line, or past every key in raw mode. Bytes between commit
+	 * and head are the line being edited. Readers consume committed bytes
+	 * at tail. The indices run freely and are masked on access. */
+	uint8_t input[INPUT_RING_SIZE];
+	volatile uint32_t head, commit, tail;
+	wait_queue_t read_wait;
+	int32_t mode;
+	struct pcb * raw_owner;  /* process that set raw mode */
+	struct pcb * vidmap_owner;  /* process drawing to the screen through vidmap */
 } terminal_t;
 
-// Initialize the keyboard device
-void kybd_init();
+// Initialize the keyboard device, each terminal keeping 'scrollback' rows
+void kybd_init(uint32_t scrollback);
 
 // Updates the screen as well as the line buffer
 void update(uint16_t key);
@@ -188,6 +207,9 @@ void update(uint16_t key);
 // Handles interrupts from the keyboard
 void keyboard_handler_main();
 
+// Show the changes to the screen on display at the next tick
+void request_flush();
+
 // Switch to terminal number 'term_num' (0-2)
 int32_t start_terminal(uint32_t term_num);
 
@@ -0,0 +1,217 @@
+/* keymap.c - Keyboard layouts, decoding scancode set 1 by table lookup
+ *
+ * Every plane of every layout is generated from one list of keys per
+ * layout, so decoding a key is a single table lookup.
+ */
+
+#include "keymap.h"
+#include "keyboard.h"
+
+/* Scancodes from http://www.brokenthorn.com/Resources/OSDev19.html */
+
+/* keys that are the same in every layout and plane: K(scancode, key).
+ * The keypad acts as with num lock off */
+#define COMMON_KEYS(K)				\
+	K(0x01, KEY_ESCAPE)				\
+	K(0x0e, KEY_BACKSPACE)			\
+	K(0x0f, KEY_TAB)				\
+	K(0x1c, KEY_RETURN)				\
+	K(0x1d, KEY_LCTRL)				\
+	K(0x2a, KEY_LSHIFT)				\
+	K(0x36, KEY_RSHIFT)				\
+	K(0x37, KEY_KP_ASTERISK)		\
+	K(0x38, KEY_LALT)				\
+	K(0x39, KEY_SPACE)				\
+	K(0x3a, KEY_CAPSLOCK)			\
+	K(0x3b, KEY_F1)					\
+	K(0x3c, KEY_F2)					\
+	K(0x3d, KEY_F3)					\
+	K(0x3e, KEY_F4)					\
+	K(0x3f, KEY_F5)					\
+	K(0x40, KEY_F6)					\
+	K(0x41, KEY_F7)					\
+	K(0x42, KEY_F8)					\
+	K(0x43, KEY_F9)					\
+	K(0x44, KEY_F10)				\
+	K(0x45, KEY_KP_NUMLOCK)			\
+	K(0x46, KEY_SCROLLLOCK)			\
+	K(0x47, KEY_HOME)				\
+	K(0x48, KEY_UP)					\
+	K(0x49, KEY_PAGEUP)				\
+	K(0x4a, KEY_KP_MINUS)			\
+	K(0x4b, KEY_LEFT)				\
+	K(0x4d, KEY_RIGHT)				\
+	K(0x4e, KEY_KP_PLUS)			\
+	K(0x4f, KEY_END)				\
+	K(0x50, KEY_DOWN)				\
+	K(0x51, KEY_PAGEDOWN)			\
+	K(0x52, KEY_INSERT)				\
+	K(0x53, KEY_DELETE)				\
+	K(0x57, KEY_F11)				\
+	K(0x58, KEY_F12)
+
+/* keys after an extended prefix: K(scancode, key) */
+#define EXTENDED_KEYS(K)			\
+	K(0x1c, KEY_RETURN)				\
+	K(0x1d, KEY_RCTRL)				\
+	K(0x35, KEY_KP_DIVIDE)			\
+	K(0x38, KEY_RALT)				\
+	K(0x47, KEY_HOME)				\
+	K(0x48, KEY_UP)					\
+	K(0x49, KEY_PAGEUP)				\
+	K(0x4b, KEY_LEFT)				\
+	K(0x4d, KEY_RIGHT)				\
+	K(0x4f, KEY_END)				\
+	K(0x50, KEY_DOWN)				\
+	K(0x51, KEY_PAGEDOWN)			\
+	K(0x52, KEY_INSERT)				\
+	K(0x53, KEY_DELETE)				\
+	K(0x5b, KEY_LWIN)				\
+	K(0x5c, KEY_RWIN)
+
+/* character keys of the US layout: C(scancode, key, key with shift) */
+#define US_KEYS(C)					\
+	C(0x02, '1', '!')				\
+	C(0x03, '2', '@')				\
+	C(0x04, '3', '#')				\
+	C(0x05, '4', '$')				\
+	C(0x06, '5', '%')				\
+	C(0x07, '6', '^')				\
+	C(0x08, '7', '&')				\
+	C(0x09, '8', '*')				\
+	C(0x0a, '9', '(')				\
+	C(0x0b, '0', ')')				\
+	C(0x0c, '-', '_')				\
+	C(0x0d, '=', '+')				\
+	C(0x10, 'q', 'Q')				\
+	C(0x11, 'w', 'W')				\
+	C(0x12, 'e', 'E')				\
+	C(0x13, 'r', 'R')				\
+	C(0x14, 't', 'T')				\
+	C(0x15, 'y', 'Y')				\
+	C(0x16, 'u', 'U')				\
+	C(0x17, 'i', 'I')				\
+	C(0x18, 'o', 'O')				\
+	C(0x19, 'p', 'P')				\
+	C(0x1a, '[', '{')				\
+	C(0x1b, ']', '}')				\
+	C(0x1e, 'a', 'A')				\
+	C(0x1f, 's', 'S')				\
+	C(0x20, 'd', 'D')				\
+	C(0x21, 'f', 'F')				\
+	C(0x22, 'g', 'G')				\
+	C(0x23, 'h', 'H')				\
+	C(0x24, 'j', 'J')				\
+	C(0x25, 'k', 'K')				\
+	C(0x26, 'l', 'L')				\
+	C(0x27, ';', ':')				\
+	C(0x28, '\'', '\"')				\
+	C(0x29, '`', '~')				\
+	C(0x2b, '\\', '|')				\
+	C(0x2c, 'z', 'Z')				\
+	C(0x2d, 'x', 'X')				\
+	C(0x2e, 'c', 'C')				\
+	C(0x2f, 'v', 'V')				\
+	C(0x30, 'b', 'B')				\
+	C(0x31, 'n', 'N')				\
+	C(0x32, 'm', 'M')				\
+	C(0x33, ',', '<')				\
+	C(0x34, '.', '>')				\
+	C(0x35, '/', '?')
+
+/* character keys of the Dvorak layout */
+#define DVORAK_KEYS(C)				\
+	C(0x02, '1', '!')				\
+	C(0x03, '2', '@')				\
+	C(0x04, '3', '#')				\
+	C(0x05, '4', '$')				\
+	C(0x06, '5', '%')				\
+	C(0x07, '6', '^')				\
+	C(0x08, '7', '&')				\
+	C(0x09, '8', '*')				\
+	C(0x0a, '9', '(')				\
+	C(0x0b, '0', ')')				\
+	C(0x0c, '[', '{')				\
+	C(0x0d, ']', '}')				\
+	C(0x10, '\'', '\"')				\
+	C(0x11, ',', '<')				\
+	C(0x12, '.', '>')				\
+	C(0x13, 'p', 'P')				\
+	C(0x14, 'y', 'Y')				\
+	C(0x15, 'f', 'F')				\
+	C(0x16, 'g', 'G')				\
+	C(0x17, 'c', 'C')				\
+	C(0x18, 'r', 'R')				\
+	C(0x19, 'l', 'L')				\
+	C(0x1a, '/', '?')				\
+	C(0x1b, '=', '+')				\
+	C(0x1e, 'a', 'A')				\
+	C(0x1f, 'o', 'O')				\
+	C(0x20, 'e', 'E')				\
+	C(0x21, 'u', 'U')				\
+	C(0x22, 'i', 'I')				\
+	C(0x23, 'd', 'D')				\
+	C(0x24, 'h', 'H')				\
+	C(0x25, 't', 'T')				\
+	C(0x26, 'n', 'N')				\
+	C(0x27, 's', 'S')				\
+	C(0x28, '-', '_')				\
+	C(0x29, '`', '~')				\
+	C(0x2b, '\\', '|')				\
+	C(0x2c, ';', ':')				\
+	C(0x2d, 'q', 'Q')				\
+	C(0x2e, 'j', 'J')				\
+	C(0x2f, 'k', 'K')				\
+	C(0x30, 'x', 'X')				\
+	C(0x31, 'b', 'B')				\
+	C(0x32, 'm', 'M')				\
+	C(0x33, 'w', 'W')				\
+	C(0x34, 'v', 'V')				\
+	C(0x35, 'z', 'Z')
+
+/* caps lock acts as shift on letters only */
+#define IS_LETTER(c)	((c) >= 'a' && (c) <= 'z')
+
+#define KEY_ENTRY(code, key)					[code] = (key),
+#define NONE_ENTRY(code, key, shift)			[code] = (key),
+#define SHIFT_ENTRY(code, key, shift)			[code] = (shift),
+#define CAPS_ENTRY(code, key, shift)			[code] = IS_LETTER(key) ? (shift) : (key),
+#define CAPS_SHIFT_ENTRY(code, key, shift)		[code] = IS_LETTER(key) ? (key) : (shift),
+
+/* all planes of a layout */
+#define KEYMAP(CHARS) { {								\
+	{ COMMON_KEYS(KEY_ENTRY) CHARS(NONE_ENTRY) },		\
+	{ COMMON_KEYS(KEY_ENTRY) CHARS(SHIFT_ENTRY) },		\
+	{ COMMON_KEYS(KEY_ENTRY) CHARS(CAPS_ENTRY) },		\
+	{ COMMON_KEYS(KEY_ENTRY) CHARS(CAPS_SHIFT_ENTRY) },	\
+	{ EXTENDED_KEYS(KEY_ENTRY) }						\
+} }
+
+const keymap_t keymaps[NUM_KEYMAPS] = {
+	[KEYMAP_US] = KEYMAP(US_KEYS),
+	[KEYMAP_DVORAK] = KEYMAP(DVORAK_KEYS)
+};
+
+const uint8_t keymap_plane[MOD_PLANE_MASK + 1] = {
+	[0] = PLANE_NONE,
+	[MOD_LSHIFT] = PLANE_SHIFT,
+	[MOD_RSHIFT] = PLANE_SHIFT,
+	[MOD_SHIFT] = PLANE_SHIFT,
+	[MOD_CAPS] = PLANE_CAPS,
+	[MOD_CAPS | MOD_LSHIFT] = PLANE_CAPS_SHIFT,
+	[MOD_CAPS | MOD_RSHIFT] = PLANE_CAPS_SHIFT,
+	[MOD_CAPS | MOD_SHIFT] = PLANE_CAPS_SHIFT
+};
+
+const uint8_t keymap_mods[2][NUM_SCANCODES] = {
+	{
+		[0x1d] = MOD_LCTRL,
+		[0x2a] = MOD_LSHIFT,
+		[0x36] = MOD_RSHIFT,
+		[0x38] = MOD_LALT
+	},
+	{
+		[0x1d] = MOD_RCTRL,
+		[0x38] = MOD_RALT
+	}
+};
@@ -0,0 +1,56 @@
+/* keymap.h - Keyboard layouts, decoding scancode set 1 by table lookup
+ *
+ */
+
+#ifndef _KEYMAP_H
+#define _KEYMAP_H
+
+#include "../types.h"
+
+#define SCANCODE_EXTENDED 0xE0  /* prefix of the extended scancodes */
+#define SCANCODE_PAUSE    0xE1  /* prefix of the Pause key's sequence */
+#define PAUSE_SKIP        2     /* bytes after each Pause prefix */
+#define NUM_SCANCODES     0x80
+
+/* modifier state. The shift and caps lock bits pick the plane of the
+ * keymap a key is looked up in */
+#define MOD_LSHIFT        0x01
+#define MOD_RSHIFT        0x02
+#define MOD_CAPS          0x04
+#define MOD_LCTRL         0x08
+#define MOD_RCTRL         0x10
+#define MOD_LALT          0x20
+#define MOD_RALT          0x40
+#define MOD_SHIFT         (MOD_LSHIFT | MOD_RSHIFT)
+#define MOD_CTRL          (MOD_LCTRL | MOD_RCTRL)
+#define MOD_ALT           (MOD_LALT | MOD_RALT)
+#define MOD_PLANE_MASK    (MOD_SHIFT | MOD_CAPS)
+
+/* planes of a keymap */
+#define PLANE_NONE        0
+#define PLANE_SHIFT       1
+#define PLANE_CAPS        2
+#define PLANE_CAPS_SHIFT  3
+#define PLANE_EXTENDED    4  /* keys after an extended prefix */
+#define NUM_PLANES        5
+
+/* layouts */
+#define KEYMAP_US         0
+#define KEYMAP_DVORAK     1
+#define NUM_KEYMAPS       2
+
+/* the key of every scancode in every plane of a layout */
+typedef struct {
+	uint16_t planes[NUM_PLANES][NUM_SCANCODES];
+} keymap_t;
+
+/* the layouts, built at compile time */
+extern const keymap_t keymaps[NUM_KEYMAPS];
+
+/* plane of each combination of the shift and caps lock bits */
+extern const uint8_t keymap_plane[MOD_PLANE_MASK + 1];
+
+/* modifier bit of each scancode, for plain and extended scancodes */
+extern const uint8_t keymap_mods[2][NUM_SCANCODES];
+
+#endif
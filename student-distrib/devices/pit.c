@@ -4,15 +4,17 @@
 #include "../lib.h"
 #include "../fs.h"
 #include "../process.h"
-#include "../sys_calls.h"
-#include "../virtualmem.h"
-#include "../x86_desc.h"
-#include "keyboard.h"
-
-#define PIT_CMD_PORT 0x40
-#define PIT0_DATA_PORT 0x43
-#define PIT_0_RESET 0x31
+#include "../sched.h"
+#include "../timer.h"
+
+#define PIT_CMD_PORT 0x43
+#define PIT0_DATA_PORT 0x40
+#define PIT_0_PERIODIC 0x34 //channel 0, lo/hi byte, mode 2 (rate generator)
+#define PIT_0_ONESHOT 0x30 //channel 0, lo/hi byte, mode 0 (interrupt on terminal count)
 #define PIT_0_LATCH 0x00
+#define PIT_0_READBACK 0xC2 //read-back, latch count and status (bits 5,4 clear) of channel 0
+#define PIT_OUT_HIGH 0x80 //status bit set once a one-shot count has run out
+#define PIT_MAX_COUNT 0xFFFF
 #define PIT_IRQ_NUM 0
 #define DEFAULT_RATE 100
 #define INPUT_CLK 1193180
@@ -20,11 +22,23 @@
 #define LOWER_B 0xFF
 #define UPPER_B 8
 
-/*helper function to reset count in channel 0 mode 0*/
-static void pit_reset_count();
+/*helper function to load a mode and count into channel 0*/
+static void pit_program(uint8_t mode, uint16_t count);
+/*helper function to count ticks that passed without interrupts*/
+static void pit_account(uint32_t counts);
+/*helper function doing the work of one tick*/
+static void pit_tick();
 
 uint16_t pit_rate = 0; //global variable for the pit rate in hz
-uint8_t * next_execute = NULL; //next process to execute
+
+/* tickless state: the periodic tick is stopped while every process is blocked */
+#define TICK_PERIODIC 0
+#define TICK_ONESHOT 1 //a one-shot runs until the next deadline
+#define TICK_STOPPED 2 //no deadline, channel 0 is masked
+
+static int32_t tick_mode = TICK_PERIODIC;
+static uint16_t oneshot_count = 0; //length of the running one-shot
+static uint32_t count_frac = 0; //counts that did not add up to a whole tick
 
 /* 
 void pit_init()
@@ -37,15 +51,18 @@ SIDE EFFECTS:
 	pit interrupt is turned on
 */
 void pit_init(){
+	uint32_t flags;
+
 	//setting up interrupt gate to proper handler
 	add_irq(PIT_IRQ_NUM, (uint32_t) pit_handler_main);
 	
 	//proper conversion from the input_clk counter to hertz
 	pit_rate = INPUT_CLK / DEFAULT_RATE;
 
-	cli();
-	pit_reset_count();
-	sti();
+	//the rate generator reloads itself, so it is programmed only once
+	cli_and_save(flags);
+	pit_program(PIT_0_PERIODIC, pit_rate);
+	restore_flags(flags);
 	
 	//enabling
 	enable_irq(PIT_IRQ_NUM);
@@ -54,76 +71,91 @@ void pit_init(){
 /* 
 void pit_handler_main()
 DESCRIPTION:
-	the interrupt handler for the programmable interval timer, also functions as the round-robin scheduler
+	the interrupt handler for the programmable interval timer, ends the time slice of the running process
 INPUT: none
 OUTPUT: none
 RETURN VALUES: none
 SIDE EFFECTS:
-	Once pit fires, initiates a context switch to run another program on a different terminal to run in a round robin fashion
+	Once pit fires, the scheduler switches to the best ready process, processes of equal priority take turns
 */
 void pit_handler_main(){
-	int32_t prev_pid, next_pid, running_term, i;
-	pcb_t * prev, * next;
-	uint8_t * command;
-	//reset early so that we do not miss any interrupts
 	send_eoi(PIT_IRQ_NUM);
-	
+
+	//a one-shot ran out, count the ticks it covered and go back to periodic
+	if(tick_mode == TICK_ONESHOT) {
+		pit_account(oneshot_count);
+		pit_program(PIT_0_PERIODIC, pit_rate);
+		tick_mode = TICK_PERIODIC;
+	} else {
+		pit_tick();
+	}
+
 	//no other processses so no context switch
-	if(!processes()) {
-		pit_reset_count();
+	if(!processes()) return;
+
+	schedule();
+}
+
+/*
+void pit_tick_stop(uint32_t ticks)
+DESCRIPTION: stops the periodic tick while the processor idles. The PIT then
+	only interrupts at the next deadline, or not at all if there is none.
+INPUT:
+	uint32_t ticks - ticks until the next deadline, 0 if there is none
+OUTPUT: none
+RETURN: none
+SIDE EFFECTS:
+	called with interrupts disabled, pit_tick_resume must follow the idle period
+*/
+void pit_tick_stop(uint32_t ticks){
+	if(tick_mode != TICK_PERIODIC) return;
+
+	if(ticks == 0) {
+		disable_irq(PIT_IRQ_NUM);
+		tick_mode = TICK_STOPPED;
 		return;
 	}
 
-	pcb(prev);
-	
-	//storing the process switching from's esp and ebp into the pcb
-	asm volatile("						\n\
-		movl	%%esp, %[prev_esp]			\n\
-		movl	%%ebp, %[prev_ebp]			\n\
-		"
-		: [prev_esp] "=m" (prev -> context.esp),
-		  [prev_ebp] "=m" (prev -> context.ebp)
-	);
-
-	/* if execution scheduled */
-	if(next_execute != NULL) {
-		command = next_execute;
-		next_execute = NULL;
-
-		pit_reset_count();
-
-		execute((uint8_t *) "shell");
-	}
+	//one-shots are whole ticks long and no longer than the counter allows
+	if(ticks > PIT_MAX_COUNT / pit_rate) ticks = PIT_MAX_COUNT / pit_rate;
+	oneshot_count = ticks * pit_rate;
 
-	/* scheduling logic */
-  	prev_pid = prev -> pid;
-  	running_term = prev -> term_num;
+	pit_program(PIT_0_ONESHOT, oneshot_count);
+	tick_mode = TICK_ONESHOT;
+}
 
-  	for(i = 1; i <= MAX_TERMINALS; i++) {
-  		next_pid = get_active_process((running_term + i) % MAX_TERMINALS);
-  		if(next_pid != -1) break;
-  	}
+/*
+void pit_tick_resume()
+DESCRIPTION: restarts the periodic tick after an idle period, counting the
+	ticks that passed while it was stopped
+INPUT: none
+OUTPUT: none
+RETURN: none
+SIDE EFFECTS:
+	called with interrupts disabled
+*/
+void pit_tick_resume(){
+	uint8_t status;
+	uint16_t count;
 
-  	next = (pcb_t *) (KERNEL_MEM_END - KERNEL_STACK_SIZE * (next_pid + 1));
+	if(tick_mode == TICK_STOPPED) {
+		//no deadline was pending, nothing measured the time that passed
+		pit_program(PIT_0_PERIODIC, pit_rate);
+		enable_irq(PIT_IRQ_NUM);
+		tick_mode = TICK_PERIODIC;
+	} else if(tick_mode == TICK_ONESHOT) {
+		outb(PIT_0_READBACK, PIT_CMD_PORT);
+		status = inb(PIT0_DATA_PORT);
+		count = (uint16_t)inb(PIT0_DATA_PORT);
+		count |= (uint16_t)inb(PIT0_DATA_PORT) << UPPER_B;
 
-	pit_reset_count();
-	
-	//case there is only one process running
-  	if(prev_pid == next_pid) return;
-
-	set_pd(next -> pd);
-
-	//setting the esp and ebp and tss_esp0 to contain that of the process switching to
-	asm volatile("							\n\
-		movl	%[next_esp], %%esp			\n\
-		movl	%[next_ebp], %%ebp 			\n\
-		movl	%[next_esp0], %[tss_esp0]	\n\
-		"
-		: [tss_esp0] "=m" (tss.esp0)
-		: [next_esp] "rm" (next -> context.esp),
-		  [next_ebp] "rm" (next -> context.ebp),
-		  [next_esp0] "r" (next -> context.esp0)
-	);
+		//if the one-shot ran out its interrupt is pending, the handler counts it
+		if(status & PIT_OUT_HIGH) return;
+
+		pit_account(oneshot_count - count);
+		pit_program(PIT_0_PERIODIC, pit_rate);
+		tick_mode = TICK_PERIODIC;
+	}
 }
 
 /*
@@ -137,8 +169,25 @@ SIDE EFFECTS:
 	changes the pit rate of firing
 */
 void pit_set_rate(uint16_t rate){
-	
+	uint32_t flags;
+
+	cli_and_save(flags);
 	pit_rate =  INPUT_CLK/rate;
+	if(tick_mode == TICK_PERIODIC)
+		pit_program(PIT_0_PERIODIC, pit_rate);
+	restore_flags(flags);
+}
+
+/*
+uint16_t pit_get_rate()
+DESCRIPTION: gets the rate the PIT ticks at (in hertz)
+INPUT: none
+OUTPUT: none
+RETURN: the tick rate in hertz
+SIDE EFFECTS: none
+*/
+uint16_t pit_get_rate(){
+	return INPUT_CLK / pit_rate;
 }
 
 /* 
@@ -153,48 +202,68 @@ SIDE EFFECTS:
 uint16_t pit_get_count(){
 	uint16_t retval;
 	uint16_t temp;
+	uint32_t flags;
 	
-	cli();
+	cli_and_save(flags);
 	//pauses the pit so that the count does not change while reading
-	outb(PIT_CMD_PORT, PIT_0_LATCH);
+	outb(PIT_0_LATCH, PIT_CMD_PORT);
 
 	//reads are 8 byte each so have to do some bit work (lowbyte then hibyte)
 	retval = (uint16_t)inb(PIT0_DATA_PORT);
 	temp = (uint16_t)inb(PIT0_DATA_PORT) << 8;
-	sti();
+	restore_flags(flags);
 	
 	return retval | temp;
 }
 
 /*
-void pit_reset_count()
-DESCRIPTION: resets the count of the pit (necessary because we are using mode 0)
+void pit_program(uint8_t mode, uint16_t count)
+DESCRIPTION: loads a mode and a count into channel 0
 INPUT: 
-	int pit_rate - the global variable that represents the rate at which the PIT fires in hz
+	uint8_t mode - the command byte selecting channel 0, lo/hi access and the mode
+	uint16_t count - the count to load
 OUTPUT: none
 RETURN: none
 SIDE EFFECTS:
-	Once the PIT sends an interrupt, it will not send another until the pit is reset
+	channel 0 restarts counting from 'count'
 */
-void pit_reset_count() {
-	//sends proper command to indicate that we are sending the count as lo/hi, for channel 3 in mode 0
-	outb(PIT_0_RESET, PIT_CMD_PORT);
+void pit_program(uint8_t mode, uint16_t count) {
+	outb(mode, PIT_CMD_PORT);
 	
 	//two bytes that represent count
-	outb((uint8_t)(pit_rate & LOWER_B), PIT0_DATA_PORT);
-	outb((uint8_t)(pit_rate >> UPPER_B), PIT0_DATA_PORT);
+	outb((uint8_t)(count & LOWER_B), PIT0_DATA_PORT);
+	outb((uint8_t)(count >> UPPER_B), PIT0_DATA_PORT);
 }
 
 /*
-void schedule_for_execution(uint8_t * command)
-DESCRIPTION: schedules the command for execution in the next scheduler cycle
-INPUT:
-	uint8_t* command - the command to be executed
+void pit_account(uint32_t counts)
+DESCRIPTION: runs the per tick work for every whole tick in 'counts' PIT
+	counts that passed while the periodic tick was stopped
+INPUT: 
+	uint32_t counts - PIT input clock counts that passed
+OUTPUT: none
+RETURN: none
+SIDE EFFECTS:
+	the part of a tick that is left over is carried to the next idle period
+*/
+void pit_account(uint32_t counts) {
+	count_frac += counts;
+	while(count_frac >= pit_rate) {
+		count_frac -= pit_rate;
+		pit_tick();
+	}
+}
+
+/*
+void pit_tick()
+DESCRIPTION: does the work of one timer tick
+INPUT: none
 OUTPUT: none
 RETURN: none
 SIDE EFFECTS:
-	next scheduler cycle will execute this command
+	runs the timers that are due and ages the ready processes
 */
-void schedule_for_execution(uint8_t * command) {
-	next_execute = command;
+void pit_tick() {
+	timer_tick();
+	sched_tick();
 }
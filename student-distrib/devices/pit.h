@@ -13,8 +13,14 @@ void pit_handler_main();
 //Sets the rate to the argument rate (in hertz)
 void pit_set_rate(uint16_t rate);
 
-//schedules a process for execution
-void schedule_for_execution(uint8_t * command);
+//gets the rate the PIT ticks at (in hertz)
+uint16_t pit_get_rate();
+
+//stops the periodic tick until the deadline 'ticks' away (0 for none)
+void pit_tick_stop(uint32_t ticks);
+
+//restarts the periodic tick after idling
+void pit_tick_resume();
 
 //gets the current count on the PIT
 uint16_t pit_get_count();
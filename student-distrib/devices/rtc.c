@@ -8,6 +8,8 @@
 #include "../lib.h"
 #include "../fs.h"
 #include "../process.h"
+#include "../slab.h"
+#include "../sched.h"
 #include "keyboard.h"
 
 #define RTC_REG_PORT 0x70  /* Port for specifying reg and disabling NMI */
@@ -25,29 +27,40 @@
 #define RATE_MAX     1024
 #define RTC_ABS_MAX  32768
 
-typedef struct {
+/* RTC state of an open RTC file, so every file has its own rate. Virtual
+ * interrupts are due at absolute times, counted in 1/RATE_MAX seconds, so
+ * they stay exact when the hardware rate changes. */
+typedef struct rtc_state {
     int32_t rate;
-    int32_t curr_count;
-    int32_t max_count;
-} rtc_process;
+    uint32_t period;    /* time between virtual interrupts */
+    uint32_t deadline;  /* time of the next virtual interrupt */
+    wait_queue_t wait;
+    struct rtc_state * next;
+} rtc_file;
 
-static int32_t rtc_open(const uint8_t * filename);
+static int32_t rtc_open(int32_t fd, const uint8_t * filename);
 static int32_t rtc_read(int32_t fd, void * buf, int32_t nbytes);
 static int32_t rtc_write(int32_t fd, const void * buf, int32_t nbytes);
 static int32_t rtc_close(int32_t fd);
+static int32_t rtc_poll(int32_t fd, poll_table_t * table);
 
+static rtc_file * get_rtc_file(int32_t fd);
 static void set_rate(int32_t rate);
-static void update_rtc_processes();
 
 static int32_t rtc_rate;
+/* virtual time in 1/RATE_MAX seconds, advanced by every interrupt */
+static uint32_t rtc_time = 0;
 static int open = 0;
-static rtc_process procs[MAX_PROCESSES];
+/* states of the open RTC files */
+static rtc_file * files = NULL;
+static slab_cache_t rtc_cache;
 
 static fops_t rtc_fops = {
     .read = rtc_read,
     .write = rtc_write,
     .open = rtc_open,
-    .close = rtc_close
+    .close = rtc_close,
+    .poll = rtc_poll
 };
 
 /*
@@ -58,28 +71,25 @@ static fops_t rtc_fops = {
  *   Return Value: none
  */
 void rtc_init() {
-    int i;
-
     /* Populate IDT entry for rtc */
     add_irq(RTC_IRQ_NUM, (uint32_t) rtc_handler_main);
 
     add_device(RTC_FTYPE, &rtc_fops);
 
-    for(i = 0; i < MAX_PROCESSES; i++) {
-        procs[i].rate = RATE_MIN;
-    }
+    slab_cache_init(&rtc_cache, "rtc", sizeof(rtc_file), 0);
 }
 
 /*
  * void rtc_handler_main
- *   Description: Acknowledges the interrupt on the PIC and RTC and sets all
- *           processes to having had an interrupt occur.
+ *   Description: Acknowledges the interrupt on the PIC and RTC, advances
+ *           the virtual time and wakes the readers of the files whose
+ *           virtual interrupt is due.
  *   Inputs: none
  *   Outputs: none
  *   Return Value: none
  */
 void rtc_handler_main() {
-    int i;
+    rtc_file * file;
 
     //test_interrupts();
     // Reset the C register to get the next interrupt
@@ -87,19 +97,39 @@ void rtc_handler_main() {
     outb(REG_C, RTC_REG_PORT);
     inb(RW_CMOS_PORT);
 
-    for(i = 0; i < MAX_PROCESSES; i++) procs[i].curr_count--;
+    rtc_time += RATE_MAX / rtc_rate;
+
+    for(file = files; file != NULL; file = file -> next) {
+        if((int32_t) (rtc_time - file -> deadline) >= 0)
+            wake_up(&file -> wait);
+    }
 }
 
 /*
  * int32_t rtc_open
- *   Description: Opens the RTC for a process and defaults the rate to 2 Hz.
- *   Inputs: filename - unused
+ *   Description: Opens the RTC on a file descriptor and defaults its rate
+ *           to 2 Hz.
+ *   Inputs: fd - the file descriptor being opened
+ *           filename - unused
  *   Outputs: none
- *   Return Value: 0 on success
- *   Side Effects: Enables RTC interrupts when the first process opens it.
+ *   Return Value: 0 on success, -1 if there is no memory for the RTC state
+ *   Side Effects: Enables RTC interrupts when the first file opens it.
  */
-int32_t rtc_open(const uint8_t * filename) {
+int32_t rtc_open(int32_t fd, const uint8_t * filename) {
     uint8_t curr;
+    uint32_t flags;
+    pcb_t * pcb;
+    rtc_file * file;
+
+    file = slab_alloc(&rtc_cache);
+    if(file == NULL) return -1;
+
+    file -> rate = RATE_MIN;
+    file -> period = RATE_MAX / RATE_MIN;
+    init_wait_queue(&file -> wait);
+
+    pcb(pcb);
+    pcb -> files[fd].private_data = file;
 
     if(!open) {
         /* Turn on RTC interrupts */
@@ -125,35 +155,67 @@ int32_t rtc_open(const uint8_t * filename) {
 
     open++;
 
+    cli_and_save(flags);
+    file -> deadline = rtc_time + file -> period;
+    file -> next = files;
+    files = file;
+    restore_flags(flags);
+
     return 0;
 }
 
 /*
  * int32_t rtc_read
- *   Description: Waits for an interrupt to happen, then returns.
- *   Inputs: fd - unused
- *           buf - unused
- *           nbytes - unused
+ *   Description: Sleeps until the file's next virtual interrupt is due,
+ *           then returns. If interrupts were due before the read they are
+ *           counted as missed and the read returns right away. On a
+ *           non-blocking fd it fails instead of sleeping.
+ *   Inputs: fd - the RTC file
+ *           buf - if it holds at least 4 bytes, gets the number of virtual
+ *                 interrupts missed since the previous read
+ *           nbytes - size of buf
  *   Outputs: none
- *   Return Value: 0 when the next interrupt has occurred.
+ *   Return Value: 0 when the next interrupt has occurred, -1 if it has not
+ *           on a non-blocking fd
  */
 int32_t rtc_read(int32_t fd, void * buf, int32_t nbytes) {
     pcb_t * pcb;
-    int32_t pid;;
+    rtc_file * file;
+    uint32_t flags, missed;
+
+    file = get_rtc_file(fd);
+    if(file == NULL) return -1;
 
     pcb(pcb);
-    pid = pcb -> pid;
 
-    procs[pid - 1].curr_count = procs[pid - 1].max_count;
-    while(procs[pid - 1].curr_count > 0);  /* spin until enough interrupts happen */
+    cli_and_save(flags);
+
+    while((int32_t) (rtc_time - file -> deadline) < 0) {  /* sleep until the deadline */
+        if(pcb -> files[fd].flags & FD_NONBLOCK) {
+            restore_flags(flags);
+            return -1;
+        }
+        sleep_on(&file -> wait);
+    }
+
+    /* consume the due interrupt and any others that passed unread */
+    missed = (rtc_time - file -> deadline) / file -> period;
+    file -> deadline += (missed + 1) * file -> period;
+
+    restore_flags(flags);
+
+    if(buf != NULL && nbytes >= (int32_t) sizeof(int32_t))
+        *((int32_t *) buf) = missed;
 
     return 0;
 }
 
 /*
  * int32_t rtc_write
- *   Description: Changes the interrupt frequency of the RTC.
- *   Inputs: fd - unused
+ *   Description: Changes the virtual interrupt frequency of a file, the
+ *           next virtual interrupt is one new period away. The RTC itself
+ *           only speeds up if no file needed the rate yet.
+ *   Inputs: fd - the RTC file
  *           buf - a pointer to an interger holding the desired rate
  *           nbytes - unused
  *   Outputs: none
@@ -161,7 +223,8 @@ int32_t rtc_read(int32_t fd, void * buf, int32_t nbytes) {
  */
 int32_t rtc_write(int32_t fd, const void * buf, int32_t nbytes) {
     int32_t rate;
-    pcb_t * pcb;
+    rtc_file * file;
+    uint32_t flags;
 
     /* check validity of buffer */
     if(buf == NULL) return -1;
@@ -169,7 +232,7 @@ int32_t rtc_write(int32_t fd, const void * buf, int32_t nbytes) {
     rate = *((int32_t *) buf);
 
     /* make sure rate is in range */
-    if(rate == 0 || rate > RATE_MAX)
+    if(rate < RATE_MIN || rate > RATE_MAX)
         return -1;
 
     /* sanity check for power of 2 */
@@ -177,35 +240,55 @@ int32_t rtc_write(int32_t fd, const void * buf, int32_t nbytes) {
     if(rate & (rate - 1))  /* will only be 0 if rate is a power of 2 */
         return -1;
 
-    pcb(pcb);
-    procs[pcb -> pid - 1].rate = rate;
-    procs[pcb -> pid - 1].max_count = rtc_rate / rate;
+    file = get_rtc_file(fd);
+    if(file == NULL) return -1;
+
+    cli_and_save(flags);
+
+    file -> rate = rate;
+    file -> period = RATE_MAX / rate;
+    file -> deadline = rtc_time + file -> period;
 
     if(rate > rtc_rate) {
         rtc_rate = rate;
         set_rate(rate);
-        update_rtc_processes();
     }
 
+    restore_flags(flags);
+
     return 1;
 }
 
 /*
  * int32_t rtc_close
- *   Description: Closes the RTC for a certain process.
- *   Inputs: fd - unused
+ *   Description: Closes the RTC on a file descriptor.
+ *   Inputs: fd - the RTC file
  *   Outputs: none
  *   Return Value: 0 on finish
- *   Side Effects: Turns off RTC interrupts when the last process closes it.
+ *   Side Effects: Turns off RTC interrupts when the last file closes it.
  */
 int32_t rtc_close(int32_t fd) {
     uint8_t curr;
-    int i;
+    int32_t rate;
+    uint32_t flags;
     pcb_t * pcb;
+    rtc_file * file, ** link;
 
-    pcb(pcb);
+    file = get_rtc_file(fd);
+    if(file == NULL) return -1;
+
+    cli_and_save(flags);
+    for(link = &files; *link != NULL; link = &((*link) -> next)) {
+        if(*link == file) {
+            *link = file -> next;
+            break;
+        }
+    }
+    restore_flags(flags);
 
-    procs[pcb -> pid - 1].rate = RATE_MIN;
+    slab_free(&rtc_cache, file);
+    pcb(pcb);
+    pcb -> files[fd].private_data = NULL;
 
     open--;
 
@@ -221,16 +304,55 @@ int32_t rtc_close(int32_t fd) {
         sti();
     } else {
         /* "trim" rtc_rate if necessary */
-        rtc_rate = RATE_MIN;
-        for(i = 0; i < MAX_PROCESSES; i++) {
-            if(procs[i].rate > rtc_rate) rtc_rate = procs[i].rate;
+        cli_and_save(flags);
+        rate = RATE_MIN;
+        for(file = files; file != NULL; file = file -> next) {
+            if(file -> rate > rate) rate = file -> rate;
         }
-        update_rtc_processes();
+        if(rate != rtc_rate) {
+            rtc_rate = rate;
+            set_rate(rate);
+        }
+        restore_flags(flags);
     }
 
     return 0;
 }
 
+/*
+ * int32_t rtc_poll
+ *   Description: Reports whether a read of an RTC file would return right
+ *           away, that is whether its next virtual interrupt is due.
+ *   Inputs: fd - the RTC file
+ *           table - poll table to wait on for the interrupt
+ *   Outputs: none
+ *   Return Value: POLLIN if the interrupt is due, 0 otherwise
+ */
+int32_t rtc_poll(int32_t fd, poll_table_t * table) {
+    rtc_file * file;
+
+    file = get_rtc_file(fd);
+    if(file == NULL) return POLLNVAL;
+
+    poll_wait(table, &file -> wait);
+
+    return (int32_t) (rtc_time - file -> deadline) >= 0 ? POLLIN : 0;
+}
+
+/*
+ * rtc_file * get_rtc_file
+ *   Description: Finds the RTC state of one of the current process' files.
+ *   Inputs: fd - the file descriptor
+ *   Outputs: none
+ *   Return Value: the state, NULL if the file is not an open RTC
+ */
+rtc_file * get_rtc_file(int32_t fd) {
+    pcb_t * pcb;
+
+    pcb(pcb);
+    return (rtc_file *) pcb -> files[fd].private_data;
+}
+
 /*
  * void set_rate
  *   Description: Sets the rate of the RTC given a value rate = 2^n
@@ -241,6 +363,7 @@ int32_t rtc_close(int32_t fd) {
 void set_rate(int32_t rate) {
     int32_t ratefactor;
     uint8_t curr, rs = 0;  /* rate select */
+    uint32_t flags;
 
     ratefactor = RTC_ABS_MAX / rate;
     /* calculate log_2(ratefactor) + 1 */
@@ -249,24 +372,10 @@ void set_rate(int32_t rate) {
     }
     rs++;
 
-    cli();
+    cli_and_save(flags);
     outb(NMI_DISABLE | REG_A, RTC_REG_PORT);
     curr = inb(RW_CMOS_PORT);
     outb(NMI_DISABLE | REG_A, RTC_REG_PORT);
     outb((curr & 0xF0) | rs, RW_CMOS_PORT);
-    sti();
-}
-
-/*
- * void update_rtc_processes
- *   Description: Updates the max count in each process for RTC virtualization
- *   Inputs: fd - unused
- *   Outputs: none
- *   Return Value: 0 on finish
- */
-void update_rtc_processes() {
-    int i;
-    for(i = 0; i < MAX_PROCESSES; i++) {
-        procs[i].max_count = rtc_rate / procs[i].rate;
-    }
+    restore_flags(flags);
 }
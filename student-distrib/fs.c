@@ -1,22 +1,32 @@
 #include "fs.h"
 #include "process.h"
+#include "virtualmem.h"
+#include "sched.h"
 
 /* Open, close, read, write system calls for the filesystem */
 static int32_t dir_read (int32_t fd, void* buf, int32_t nbytes);
 static int32_t fs_read (int32_t fd, void* buf, int32_t nbytes);
 static int32_t fs_write (int32_t fd, const void* buf, int32_t nbytes);
-static int32_t fs_open (const uint8_t* filename);
+static int32_t fs_open (int32_t fd, const uint8_t* filename);
 static int32_t fs_close (int32_t fd);
+static int32_t fs_poll (int32_t fd, poll_table_t* table);
 
 /* pointer to the bootblock of our filesystem */
 static bootblock_t* bootblock;
 
+/* name -> dentry index, chained through name_next; -1 terminates a chain */
+static int8_t name_hash[FS_HASH_SIZE];
+static int8_t name_next[NUM_INODES];
+/* precomputed name lengths, names may fill all 32 bytes without a NUL */
+static uint8_t name_len[NUM_INODES];
+
 /* file operations for a file */
 static fops_t fs_fops = {
 	.read = fs_read,
 	.write = fs_write,
 	.open = fs_open,
-	.close = fs_close
+	.close = fs_close,
+	.poll = fs_poll
 };
 
 /* file operations for a directory */
@@ -24,7 +34,8 @@ static fops_t dir_fops = {
 	.read = dir_read,
 	.write = fs_write,
 	.open = fs_open,
-	.close = fs_close
+	.close = fs_close,
+	.poll = fs_poll
 };
 
 /* fs_init
@@ -35,14 +46,38 @@ static fops_t dir_fops = {
  *    RETURN VALUE: none
  */
 void fs_init(module_t *mem_mod){
+	int32_t i, cnt;
+	uint32_t len, hash;
+	int8_t * name;
+
 	bootblock = (bootblock_t*)mem_mod->mod_start;
 
+	/* build the name index once so lookups don't scan the boot block */
+	for(i = 0; i < FS_HASH_SIZE; i++)
+		name_hash[i] = -1;
+
+	cnt = bootblock->dir_entries_cnt;
+	if(cnt > NUM_INODES) cnt = NUM_INODES;
+
+	for(i = cnt - 1; i >= 0; i--){
+		name = bootblock->dentry[i].fname;
+		hash = FS_HASH_INIT;
+		for(len = 0; len < FNAME_LEN && name[len] != '\0'; len++)
+			hash = (hash ^ (uint8_t) name[len]) * FS_HASH_PRIME;
+
+		/* insert at the head, walking backwards keeps the first match first */
+		name_len[i] = len;
+		name_next[i] = name_hash[hash & FS_HASH_MASK];
+		name_hash[hash & FS_HASH_MASK] = i;
+	}
+
 	add_device(FILE_FTYPE, &fs_fops);
 	add_device(DIR_FTYPE, &dir_fops);
 }
 
 /* read_dentry_by_name
- *	  DESCRIPTION: reads the dentry by filename
+ *	  DESCRIPTION: reads the dentry by filename using the name index built
+ *				   in fs_init
  *    INPUTS: fname - filename specifying the file to read from
  *			  dentry - pointer to dentry block to fill
  *    OUTPUTS: none
@@ -51,19 +86,24 @@ void fs_init(module_t *mem_mod){
  * 					file type, and inode number
  */
  int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry){
- 	int i;
- 	dentry_t* curr_dentry; //iterate through dentries
- 	curr_dentry = &(bootblock->dentry[0]);
-
- 	for(i = 0; i < bootblock->dir_entries_cnt; i++){	
- 		if((strlen((int8_t*)fname) == strlen((int8_t *) curr_dentry->fname))){
-			//we !strcmp because strcmp returns 0 on a match
- 			if(!strncmp((int8_t *) fname, (int8_t *) curr_dentry->fname, strlen((int8_t*)curr_dentry->fname))){ 
- 				memcpy(dentry, curr_dentry, BYTES_DENTRY);
- 				return 0;
- 			}
+ 	uint32_t len, hash;
+ 	int32_t idx;
+
+ 	if(fname == NULL || dentry == NULL) return -1;
+
+ 	/* hash the name, giving up on anything longer than a dentry can hold */
+ 	hash = FS_HASH_INIT;
+ 	for(len = 0; fname[len] != '\0'; len++){
+ 		if(len >= FNAME_LEN) return -1;
+ 		hash = (hash ^ fname[len]) * FS_HASH_PRIME;
+ 	}
+
+ 	for(idx = name_hash[hash & FS_HASH_MASK]; idx != -1; idx = name_next[idx]){
+ 		if(name_len[idx] == len &&
+ 				!strncmp((int8_t *) fname, (int8_t *) bootblock->dentry[idx].fname, len)){
+ 			memcpy(dentry, &(bootblock->dentry[idx]), BYTES_DENTRY);
+ 			return 0;
  		}
- 		curr_dentry++;
  	}
  	return -1;
  }
@@ -101,43 +141,41 @@ void fs_init(module_t *mem_mod){
  *					the file
  */
  int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length){
- 	uint32_t i;
- 	int32_t bytes_read = 0;
- 	data_block_t* curr_data_block; // data to copy to buf
- 	int32_t off_data_block; // data block number in inode
- 	int32_t new_offset; // offset once inside correct data block
+ 	uint32_t bytes_read, chunk;
+ 	uint32_t off_data_block; // data block number in inode
+ 	uint32_t new_offset; // offset once inside correct data block
  	inode_t *curr_inode;
- 	bytes_read = 0;
 
-	// bytes_read = read_directory_entry(offset, buf, length);
+ 	if(inode >= bootblock->inode_cnt){
+ 		return 0;
+ 	}
+
+ 	curr_inode = get_inode_ptr(inode);
 
- 	if(inode < 0 || inode >= bootblock->inode_cnt){
- 		return bytes_read;
+ 	// clamp the read to EOF once so the copy loop never looks past the file
+ 	if(offset >= curr_inode->length){
+ 		return 0;
+ 	}
+ 	if(length > curr_inode->length - offset){
+ 		length = curr_inode->length - offset;
  	}
 
  	// calculate correct data block and offset to start copying from
  	new_offset = offset % CHARS_PER_BLOCK;
  	off_data_block = offset / CHARS_PER_BLOCK;
- 	curr_inode = (inode_t*)((uint8_t*) bootblock + ((inode+1) * BLOCK_SIZE));
- 	curr_data_block = (data_block_t*) ((uint8_t*) bootblock + (1 + bootblock->inode_cnt + curr_inode->data_block[off_data_block])*BLOCK_SIZE);
-
- 		// copy data to buf
- 	for(i = 0; i < length; i++){
- 			//check for EOF
- 		if(bytes_read + offset < curr_inode->length){
- 			buf[i] = curr_data_block->data[new_offset];
- 			bytes_read++;
- 			new_offset++;
-				// move to next data block
- 			if(new_offset >= CHARS_PER_BLOCK){ 
- 				off_data_block++;
- 				curr_data_block = (data_block_t*) ((uint8_t*) bootblock + (1 + bootblock->inode_cnt + curr_inode->data_block[off_data_block])*BLOCK_SIZE);
- 				new_offset = 0;
- 			}
+
+ 	// copy the rest of each data block in one run
+ 	for(bytes_read = 0; bytes_read < length; bytes_read += chunk){
+ 		chunk = CHARS_PER_BLOCK - new_offset;
+ 		if(chunk > length - bytes_read){
+ 			chunk = length - bytes_read;
  		}
+ 		memcpy(buf + bytes_read, get_data_block_ptr(curr_inode, off_data_block)->data + new_offset, chunk);
+ 		off_data_block++;
+ 		new_offset = 0;
  	}
- return bytes_read;
-}
+ 	return bytes_read;
+ }
 
  /* read_directory
  *	  DESCRIPTION: copies over 'length' bytes of directory entries into 'buf'
@@ -229,6 +267,60 @@ void fs_init(module_t *mem_mod){
  	return 0;
  }
 
+ /* load_mapped
+ *	  DESCRIPTION: maps the data blocks of the file 'd' read-only into the
+ *				   user page table 'pt' starting at address 'mem', instead of
+ *				   copying them. Pages are copied on their first write.
+ *    INPUTS: d - dentry of the executable to map
+ *			  pt - page table of the user program region
+ *			  mem - page aligned user address to map the file at
+ *    OUTPUTS: none
+ *    RETURN VALUE: 0 on success, -1 if the file can't be mapped
+ *    SIDE EFFECTS: changes the PTEs covering the file in 'pt'
+ */
+ int32_t load_mapped(dentry_t * d, uint32_t * pt, uint8_t * mem) {
+ 	uint32_t i, blocks;
+ 	inode_t * curr_inode;
+
+ 	if(d == NULL || pt == NULL || mem == NULL) return -1;
+
+ 	/* blocks are only pages if the module and the target are page aligned */
+ 	if(((uint32_t) bootblock | (uint32_t) mem) & (PAGE_SIZE - 1)) return -1;
+
+ 	curr_inode = get_inode_ptr(d -> inode);
+ 	blocks = (curr_inode -> length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+ 	if((uint32_t) mem + blocks * BLOCK_SIZE > PROG_VM_START + SPACE_4MB) return -1;
+
+ 	for(i = 0; i < blocks; i++) {
+ 		set_pte(pt, (uint32_t) mem + i * BLOCK_SIZE,
+ 				(uint32_t) get_data_block_ptr(curr_inode, i),
+ 				FLAG_COW | FLAG_U | FLAG_P);
+ 	}
+ 	return 0;
+ }
+
+ /* get_file_page
+ *	  DESCRIPTION: gets the data block holding 'offset' of a file so it can
+ *				   be mapped as a page.
+ *    INPUTS: inode - inode number of the file
+ *			  offset - page aligned offset in the file
+ *    OUTPUTS: none
+ *    RETURN VALUE: address of the block, or NULL if the block can't be
+ *					mapped (module not page aligned, or past EOF)
+ */
+ data_block_t * get_file_page(uint32_t inode, uint32_t offset) {
+ 	inode_t * curr_inode;
+
+ 	if(inode >= bootblock->inode_cnt || ((uint32_t) bootblock & (PAGE_SIZE - 1)))
+ 		return NULL;
+
+ 	curr_inode = get_inode_ptr(inode);
+ 	if(offset >= curr_inode->length) return NULL;
+
+ 	return get_data_block_ptr(curr_inode, offset / BLOCK_SIZE);
+ }
+
 /* get_inode_ptr
  *	  DESCRIPTION: get inode pointer given an inode number.
  *    INPUTS: inode - inode number to get the corresponding inode pointer to.
@@ -239,6 +331,18 @@ void fs_init(module_t *mem_mod){
  	return (inode_t*) ((uint8_t*) bootblock + (inode + 1) * BLOCK_SIZE);
  }
 
+/* get_data_block_ptr
+ *	  DESCRIPTION: get a pointer to one of an inode's data blocks.
+ *    INPUTS: curr_inode - inode that owns the data block
+ *			  idx - index of the data block within the inode
+ *    OUTPUTS: none
+ *    RETURN VALUE: pointer to the data block
+ */
+ data_block_t * get_data_block_ptr(inode_t * curr_inode, uint32_t idx) {
+ 	return (data_block_t*) ((uint8_t*) bootblock +
+ 			(1 + bootblock->inode_cnt + curr_inode->data_block[idx]) * BLOCK_SIZE);
+ }
+
 /* dir_read
  *	  DESCRIPTION: reads directory entries in the filesystem.
  *    INPUTS: fd - file descriptor describing the file to read.
@@ -289,7 +393,7 @@ int32_t dir_read (int32_t fd, void* buf, int32_t nbytes){
  }
 
  /* opening a file is handeled by the open system call */
- int32_t fs_open (const uint8_t* filename){ 
+ int32_t fs_open (int32_t fd, const uint8_t* filename){ 
  	return 0; 
  }
 
@@ -297,3 +401,8 @@ int32_t dir_read (int32_t fd, void* buf, int32_t nbytes){
  int32_t fs_close (int32_t fd){ 
  	return 0; 
  }
+
+ /* files and directories are in memory, reading them never blocks */
+ int32_t fs_poll (int32_t fd, poll_table_t* table){
+ 	return POLLIN;
+ }
@@ -20,6 +20,12 @@
 #define FILE_FTYPE	2
 #define TERM_FTYPE	3
 
+/* dentry name index, FNV-1a over the name bytes */
+#define FS_HASH_SIZE	128
+#define FS_HASH_MASK	(FS_HASH_SIZE - 1)
+#define FS_HASH_INIT	2166136261U
+#define FS_HASH_PRIME	16777619U
+
 typedef struct dentry {
 	int8_t fname[FNAME_LEN];
 	int32_t ftype; //0-RTC, 1-Directory, 2-Regular File
@@ -44,11 +50,22 @@ typedef struct data_block {
 	uint8_t data[CHARS_PER_BLOCK];
 } data_block_t;
 
+/* ioctl commands */
+#define IOCTL_NONBLOCK	1	/* arg 1 makes reads on the fd return instead of waiting */
+#define IOCTL_TERM_MODE	2	/* arg TERM_COOKED or TERM_RAW, for the terminal */
+#define IOCTL_KEYMAP	3	/* arg KEYMAP_US or KEYMAP_DVORAK, for the terminal */
+
+struct poll_table;
+
 typedef struct {
 	int32_t (*read) (int32_t fd, void* buf, int32_t nbytes);
 	int32_t (*write) (int32_t fd, const void* buf, int32_t nbytes);
-	int32_t (*open) (const uint8_t* filename);
+	int32_t (*open) (int32_t fd, const uint8_t* filename);
 	int32_t (*close) (int32_t fd);
+	/* returns the POLL* events ready on fd, and waits on table for more */
+	int32_t (*poll) (int32_t fd, struct poll_table* table);
+	/* device specific control, may be NULL */
+	int32_t (*ioctl) (int32_t fd, int32_t cmd, int32_t arg);
 } fops_t;
 
 /* Initialize filesystem */
@@ -72,7 +89,16 @@ int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length
 /* get pointer to inode */
 inode_t * get_inode_ptr(uint32_t inode);
 
+/* get pointer to one of an inode's data blocks */
+data_block_t * get_data_block_ptr(inode_t * curr_inode, uint32_t idx);
+
 /* Loads an executable file into correct location in memory */
 int32_t load(dentry_t * d, uint8_t * mem);
 
+/* Maps an executable file's blocks copy-on-write into a user page table */
+int32_t load_mapped(dentry_t * d, uint32_t * pt, uint8_t * mem);
+
+/* Gets the data block holding an offset of a file if it can be mapped */
+data_block_t * get_file_page(uint32_t inode, uint32_t offset);
+
 #endif /* _FS_H */
@@ -7,6 +7,7 @@
 #include "virtualmem.h"
 
 #define NUM_IRQS 16
+#define PAGE_FAULT 14
 
 struct regs
 {
@@ -178,20 +179,34 @@ void isrs_install(){
  *INPUT: a register structure that has the state of the machine and which error included
  *OUTPUT: prints "Exception <exception#>: <exception message> " on a known exception(one of the first 32)
  *	  prints "Unknown exception <exception#>" on an unknown exception
- *RETURN: none
+ *RETURN: none, or returns to the faulting instruction if a page fault was resolved
  *SIDE EFFECT: Spins indefinately at aka and blue screens
  */
 void fault_handler(struct regs * r){
-	pcb_t * pcb;
+	pcb_t * pcb = NULL;
 	terminal_t * terminal;
+	uint32_t addr, esp;
 
+	/* a fault off the kernel stack of a process has no process to blame */
 	if(processes()) {
-		pcb(pcb);
+		get_esp(esp);
+		pcb = stack_pcb(esp);
+	}
+
+	if(pcb != NULL) {
+
+		/* demand paged and copy-on-write pages of the user program */
+		if(r -> int_no == PAGE_FAULT) {
+			get_cr2(addr);
+			if(!user_page_fault(pcb, addr, r -> err_code))
+				return;
+		}
+
 		terminal = get_terminal(pcb -> term_num);
 
 		set_screen_x(terminal -> screen.x);
 		set_screen_y(terminal -> screen.y);
-		set_video_mem(terminal -> screen.video_mem + PAGE_SIZE * (pcb -> term_num + 1));
+		set_video_mem(terminal -> screen.video_mem);
 
 		printf("Process terminated with exception %d: %s (%d)\n",
 			r -> int_no,
@@ -200,7 +215,9 @@ void fault_handler(struct regs * r){
 
 		terminal -> screen.x = get_screen_x();
 		terminal -> screen.y = get_screen_y();
-		terminal -> screen.video_mem = get_video_mem() - PAGE_SIZE * (pcb -> term_num + 1);
+		set_video_mem((char *) VIDEO);
+		touch_screen(&(terminal -> screen));
+		request_flush();
 
 		halt(1);
 	} else {
@@ -9,4 +9,7 @@ void isrs_install();
 /* register a device handler on an irq */
 void add_irq(uint32_t irq, uint32_t handler_addr);
 
+/* entry point of system calls made with SYSENTER */
+void handle_sysenter();
+
 #endif
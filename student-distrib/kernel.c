@@ -15,18 +15,79 @@
 #include "fs.h"
 #include "sys_calls.h"
 #include "process.h"
+#include "physmem.h"
+#include "timer.h"
 
 
 /* Macros. */
 /* Check if the bit BIT in FLAGS is set. */
 #define CHECK_FLAG(flags,bit)   ((flags) & (1 << (bit)))
 
+/* Model specific registers of SYSENTER, and the CPUID feature bit that
+   says the CPU has it. */
+#define MSR_SYSENTER_CS		0x174
+#define MSR_SYSENTER_ESP	0x175
+#define MSR_SYSENTER_EIP	0x176
+#define CPUID_SEP			(1 << 11)
+
+/* Stack SYSENTER starts on. The entry point moves to the kernel stack of
+   the process right away. Before that, a program entering with TF set
+   takes a debug trap on this stack, which isr1 handles without looking
+   for a process. */
+#define SYSENTER_STACK_WORDS	256
+static uint32_t sysenter_stack[SYSENTER_STACK_WORDS];
+
+/* Boot option setting the rows of scrollback of each terminal. */
+#define SCROLLBACK_OPTION "scrollback="
+
+/* Read the value of the scrollback option from the boot command line, or
+   return DEF if it is not given. */
+static uint32_t
+scrollback_option (const char *cmdline, uint32_t def)
+{
+	uint32_t len = strlen ((int8_t *) SCROLLBACK_OPTION);
+	uint32_t rows;
+
+	while (*cmdline != '\0')
+	{
+		if (!strncmp ((int8_t *) cmdline, (int8_t *) SCROLLBACK_OPTION, len)
+				&& *(cmdline + len) >= '0' && *(cmdline + len) <= '9')
+		{
+			rows = 0;
+			for (cmdline += len; *cmdline >= '0' && *cmdline <= '9'; cmdline++)
+				rows = rows * 10 + (*cmdline - '0');
+			return rows;
+		}
+
+		/* skip to the next word */
+		while (*cmdline != '\0' && *cmdline != ' ')
+			cmdline++;
+		while (*cmdline == ' ')
+			cmdline++;
+	}
+	return def;
+}
+
+/* Check whether the CPU has SYSENTER and SYSEXIT. */
+static int
+has_sysenter (void)
+{
+	uint32_t eax = 1, edx;
+
+	asm volatile ("cpuid"
+			: "+a" (eax), "=d" (edx)
+			:
+			: "ebx", "ecx");
+	return (edx & CPUID_SEP) != 0;
+}
+
 /* Check if MAGIC is valid and print the Multiboot information structure
    pointed by ADDR. */
 void
 entry (unsigned long magic, unsigned long addr)
 {
 	multiboot_info_t *mbi;
+	uint32_t scrollback = SCROLLBACK_DEFAULT;
 
 	/* Clear the screen. */
 	clear();
@@ -54,8 +115,10 @@ entry (unsigned long magic, unsigned long addr)
 		printf ("boot_device = 0x%#x\n", (unsigned) mbi->boot_device);
 
 	/* Is the command line passed? */
-	if (CHECK_FLAG (mbi->flags, 2))
+	if (CHECK_FLAG (mbi->flags, 2)) {
 		printf ("cmdline = %s\n", (char *) mbi->cmdline);
+		scrollback = scrollback_option ((char *) mbi->cmdline, scrollback);
+	}
 
 	if (CHECK_FLAG (mbi->flags, 3)) {
 		int mod_count = 0;
@@ -153,23 +216,38 @@ entry (unsigned long magic, unsigned long addr)
 		ltr(KERNEL_TSS);
 	}
 
+	/* Set up the SYSENTER entry point next to int $0x80, the GDT has the
+	   kernel and user segments in the order SYSENTER and SYSEXIT expect */
+	if (has_sysenter ())
+	{
+		wrmsr(MSR_SYSENTER_CS, KERNEL_CS);
+		wrmsr(MSR_SYSENTER_ESP, (uint32_t) &sysenter_stack[SYSENTER_STACK_WORDS]);
+		wrmsr(MSR_SYSENTER_EIP, (uint32_t) handle_sysenter);
+	}
+
 	/* Init the PIC */
 	i8259_init();
 
 	/* Initialize devices, memory, filesystem, enable device interrupts on the
 	 * PIC, any other initialization stuff... */
 	fs_init((module_t *)mbi->mods_addr);
+	physmem_init(mbi);
+	/* kernel stacks must stay above the modules loaded after the kernel */
+	process_init(((module_t *)mbi->mods_addr)[mbi->mods_count - 1].mod_end);
 	virtualmem_init();
 
 	/* Initialize IDT - must occur before other devices are initialized */
 	isrs_install();
 
 	/* Initialize keyboard: fill IDT entry for keyboard, unmask keyboard interrupt on PIC */
-	kybd_init();
+	kybd_init(scrollback);
 
 	/* Initialize RTC: fill IDT entry for RTC, unmask RTC interrupt on PIC */
 	rtc_init();
 
+	/* Initialize the kernel timers driven by the PIT tick */
+	timer_init();
+
 	/*INitialize PIT: fill IDT entry for PIT, unmask RTC interrupt on PIC*/
 	pit_init();
 
@@ -7,16 +7,42 @@
 #define NUM_COLS 80
 #define NUM_ROWS 25
 #define ATTRIB 0x7
+#define BLANK_CELL ((ATTRIB << 8) | ' ')
+
+#define ALL_ROWS ((1 << NUM_ROWS) - 1)
+
+/* characters write_in_terminal draws with interrupts off at a time */
+#define WRITE_CHUNK (NUM_ROWS * NUM_COLS)
+
+/* cells of VGA memory, and the last cell row 0 of the display can start at */
+#define VGA_CELLS (VIDEO_SIZE >> 1)
+#define VGA_MAX_TOP ((VGA_CELLS / NUM_COLS - NUM_ROWS) * NUM_COLS)
 
 #define VGA_BASE 0x3D4
 #define CURSOR_LOW 0x0F
 #define CURSOR_HIGH 0x0E
+#define CURSOR_HIDDEN 0xFFFF  /* past any cell the display can show */
 #define START_ADDR_REG_HIGH 0x0C
 #define START_ADDR_REG_LOW  0x0D
 
 static int screen_x;
 static int screen_y;
 static char* video_mem = (char *)VIDEO;
+/* the terminal screen the VGA displays, and the cell of VGA memory it
+ * starts at */
+static screen_t * shown_screen = NULL;
+static int vga_top = 0;
+/* copy of the cells on display, so a flush only writes the cells that
+ * changed to VGA memory, and the rows of the display the copy does not
+ * know yet */
+static uint16_t vga_shadow[NUM_ROWS * NUM_COLS];
+static uint32_t stale_rows = ALL_ROWS;
+
+static void mark_rows(screen_t * screen, int first, int last);
+static void flush_row(uint16_t * src, int row, int whole);
+static uint16_t * history_row(history_t * history, uint32_t idx);
+static uint16_t * text_row(screen_t * screen, int y);
+static uint16_t * view_row(screen_t * screen, int row);
 
 /*
 * void clear(void);
@@ -46,13 +72,231 @@ clear(void)
 void
 clear_terminal(screen_t * screen)
 {
-    int32_t i;
-    for(i=0; i<NUM_ROWS*NUM_COLS; i++) {
-        *(uint8_t *)(screen -> video_mem + (i << 1)) = ' ';
-        *(uint8_t *)(screen -> video_mem + (i << 1) + 1) = ATTRIB;
-    }
+    memset_word(screen -> video_mem, BLANK_CELL, NUM_ROWS * NUM_COLS);
     screen -> x = 0;
     screen -> y = 0;
+    screen -> view = 0;
+    touch_screen(screen);
+}
+
+/*
+* void show_screen
+*   Inputs: screen - a pointer to a specific screen
+*   Return Value: none
+*	Function: Puts a terminal's screen on display, drawing all of it
+*/
+void
+show_screen(screen_t * screen)
+{
+    uint32_t flags;
+
+    cli_and_save(flags);
+    shown_screen = screen;
+    vga_top = 0;
+    set_vga_start(0);
+    screen -> scrolled = 0;
+    stale_rows = ALL_ROWS;
+    flush_screen(screen);
+    restore_flags(flags);
+}
+
+/*
+* void flush_screen
+*   Inputs: screen - a pointer to a specific screen
+*   Return Value: none
+*	Function: Brings the display up to date with a screen if it is on
+*             display. Rows the screen scrolled by are scrolled on the VGA by
+*             moving its start address through VGA memory, only once the end
+*             is reached is the whole screen copied back to the beginning.
+*             Then the rows that changed are compared with what is on
+*             display, and only the cells that differ are copied. A screen
+*             scrolled back into its history is drawn again as a whole.
+*/
+void
+flush_screen(screen_t * screen)
+{
+    uint32_t dirty, stale, flags;
+    int row, rows;
+
+    cli_and_save(flags);
+
+    if(screen != shown_screen) {
+        restore_flags(flags);
+        return;
+    }
+
+    rows = screen -> scrolled;
+    if(screen -> view) {
+        /* the window into the history stays where it is */
+        rows = 0;
+        screen -> dirty = ALL_ROWS;
+    }
+    if(rows) {
+        if(rows < NUM_ROWS && vga_top + rows * NUM_COLS <= VGA_MAX_TOP) {
+            vga_top += rows * NUM_COLS;
+            memmove_word(vga_shadow, vga_shadow + rows * NUM_COLS, (NUM_ROWS - rows) * NUM_COLS);
+            /* the rows scrolled in hold old VGA memory */
+            stale_rows = (stale_rows >> rows) | (ALL_ROWS & ~(ALL_ROWS >> rows));
+        } else {
+            vga_top = 0;
+            stale_rows = ALL_ROWS;
+        }
+        set_vga_start(vga_top << 1);
+    }
+    stale = stale_rows;
+    dirty = screen -> dirty | stale;
+    stale_rows = 0;
+    screen -> dirty = 0;
+    screen -> scrolled = 0;
+
+    for(row = 0; dirty; row++, dirty >>= 1) {
+        if(dirty & 1)
+            flush_row(view_row(screen, row), row, stale & 1);
+        stale >>= 1;
+    }
+
+    move_cursor(screen);
+
+    restore_flags(flags);
+}
+
+/*
+* void flush_row
+*   Inputs: src - the cells to display in the row
+*           row - the row to flush
+*           whole - nonzero if the row on display is not known
+*   Return Value: none
+*	Function: Copies the span of a row from its first to its last cell
+*             that differs from the display to VGA memory, or the whole row
+*/
+static void
+flush_row(uint16_t * src, int row, int whole)
+{
+    uint16_t * seen = vga_shadow + row * NUM_COLS;
+    int first = 0, last = NUM_COLS - 1;
+
+    if(!whole) {
+        while(first < NUM_COLS && src[first] == seen[first])
+            first++;
+        if(first == NUM_COLS) return;
+        while(src[last] == seen[last])
+            last--;
+    }
+
+    memmove_word(seen + first, src + first, last - first + 1);
+    memmove_word((uint16_t *) VIDEO + vga_top + row * NUM_COLS + first, src + first, last - first + 1);
+}
+
+/*
+* uint16_t * history_row
+*   Inputs: history - a scrollback history
+*           idx - the number of a row ever added to the history
+*   Return Value: the cells of the row in the ring
+*	Function: Finds where a row of the history is kept
+*/
+static uint16_t *
+history_row(history_t * history, uint32_t idx)
+{
+    idx %= history -> size;
+    return history -> pages[idx / HISTORY_PAGE_ROWS] + (idx % HISTORY_PAGE_ROWS) * NUM_COLS;
+}
+
+/*
+* uint16_t * text_row
+*   Inputs: screen - a pointer to a specific screen
+*           y - a row of the screen, rows above it are the newest rows
+*               of its history
+*   Return Value: the cells of the row, NULL if the row is not kept
+*	Function: Finds the cells of a row of text
+*/
+static uint16_t *
+text_row(screen_t * screen, int y)
+{
+    history_t * history = screen -> history;
+
+    if(y >= 0)
+        return (uint16_t *) screen -> video_mem + y * NUM_COLS;
+    if(history == NULL || -y > (int) history -> size || -y > (int) history -> head)
+        return NULL;
+    return history_row(history, history -> head + y);
+}
+
+/*
+* uint16_t * view_row
+*   Inputs: screen - a pointer to a specific screen
+*           row - a row of the display
+*   Return Value: the cells shown in the row
+*	Function: Finds the cells a row of the display shows, which come from
+*             the history while the screen is scrolled back
+*/
+static uint16_t *
+view_row(screen_t * screen, int row)
+{
+    return text_row(screen, row - screen -> view);
+}
+
+/*
+* void scroll_view
+*   Inputs: screen - a pointer to a specific screen
+*           rows - rows to scroll back into the history, negative to scroll
+*                  forward again
+*   Return Value: none
+*	Function: Moves the display back through the rows kept in the history,
+*             as far as the oldest one, or forward to the screen itself
+*/
+void
+scroll_view(screen_t * screen, int32_t rows)
+{
+    history_t * history = screen -> history;
+    uint32_t flags;
+    int kept;
+
+    if(history == NULL) return;
+
+    cli_and_save(flags);
+    kept = history -> head < history -> size ? history -> head : history -> size;
+    rows += screen -> view;
+    if(rows > kept) rows = kept;
+    if(rows < 0) rows = 0;
+    if(rows != screen -> view) {
+        screen -> view = rows;
+        screen -> dirty = ALL_ROWS;
+    }
+    restore_flags(flags);
+}
+
+/*
+* void touch_screen
+*   Inputs: screen - a pointer to a specific screen
+*   Return Value: none
+*	Function: Marks every row of a screen as changed, for writes that did
+*             not go through the screen functions
+*/
+void
+touch_screen(screen_t * screen)
+{
+    mark_rows(screen, 0, NUM_ROWS - 1);
+}
+
+/*
+* void mark_rows
+*   Inputs: screen - a pointer to a specific screen
+*           first, last - the range of rows that changed
+*   Return Value: none
+*	Function: Marks rows of a screen as changed since the last flush
+*/
+static void
+mark_rows(screen_t * screen, int first, int last)
+{
+    uint32_t flags;
+
+    if(first < 0) first = 0;
+    if(last > NUM_ROWS - 1) last = NUM_ROWS - 1;
+    if(first > last) return;
+
+    cli_and_save(flags);
+    screen -> dirty |= (ALL_ROWS >> (NUM_ROWS - 1 - last)) & ~((1 << first) - 1);
+    restore_flags(flags);
 }
 
 /*
@@ -110,17 +354,24 @@ set_video_mem(char * mem) {
 
 /*
 * void move_cursor
-*   Inputs: term_num - the number identifying the terminal whose cursor is moving
-*           screen - a pointer to a specific screen
-*           term_mem_length - the length of one terminal's video memory
+*   Inputs: screen - a pointer to a specific screen
 *   Return Value: void
-*	Function: Moves the cursor in the specific terminal to the specified location
+*	Function: Moves the hardware cursor to the screen's cursor if the
+*             screen is on display, and hides it while the display is scrolled
+*             back past the cursor's row
 */
 void
-move_cursor(int32_t term_num, screen_t * screen, uint32_t term_mem_length){
+move_cursor(screen_t * screen){
 	// Source: http://wiki.osdev.org/Text_Mode_Cursor
-	unsigned short position = (screen -> y * NUM_COLS) + screen -> x +
-			((term_num * term_mem_length) >> 1);
+	int position;
+
+	if(screen != shown_screen) return;
+
+	/* scrolled back far enough, the cursor's row is not on display */
+	if(screen -> y + screen -> view >= NUM_ROWS)
+		position = CURSOR_HIDDEN;
+	else
+		position = vga_top + ((screen -> y + screen -> view) * NUM_COLS) + screen -> x;
 
     // cursor LOW port to vga INDEX register
 	outb(CURSOR_LOW, VGA_BASE);
@@ -157,15 +408,58 @@ vert_scroll(void){
 */
 void
 vert_scroll_in_terminal(screen_t * screen){
-  int32_t i;
-  for(i=0; i<(NUM_ROWS - 1)*NUM_COLS; i++) {
-    *(uint8_t *)(screen -> video_mem + (i << 1)) = *(uint8_t *)(screen -> video_mem + ((i + NUM_COLS) << 1));
-    *(uint8_t *)(screen -> video_mem + (i << 1) + 1) = ATTRIB;
-  }
-  for(i=(NUM_ROWS - 1)*NUM_COLS; i<NUM_ROWS*NUM_COLS; i++){
-    *(uint8_t *)(screen -> video_mem + (i << 1)) = ' ';
-    *(uint8_t *)(screen -> video_mem + (i << 1) + 1) = ATTRIB;
+  scroll_in_terminal(screen, 1);
+}
+
+/*
+* void scroll_in_terminal
+*   Inputs: screen - a pointer to a specific screen
+*           rows - number of rows to scroll by
+*   Return Value: void
+*	Function: Scrolls the screen up by several rows with one word-wide move,
+*             blanking the rows that come in at the bottom. The rows that
+*             scroll off are added to the history, each costs one row copy,
+*             and rows beyond the screen are added blank for the caller to
+*             draw into. The display follows at the next flush.
+*/
+void
+scroll_in_terminal(screen_t * screen, int32_t rows){
+  uint16_t * cells = (uint16_t *) screen -> video_mem;
+  history_t * history = screen -> history;
+  uint32_t flags;
+  int32_t i, extra;
+
+  if(rows <= 0) return;
+
+  /* a flush in between would see the cells and the rows to scroll disagree */
+  cli_and_save(flags);
+
+  if(history != NULL) {
+    for(i = 0; i < rows && i < NUM_ROWS; i++)
+      memmove_word(history_row(history, history -> head++), cells + i * NUM_COLS, NUM_COLS);
+
+    /* only the newest rows fit in the ring */
+    extra = rows - i;
+    if(extra > (int32_t) history -> size) {
+      history -> head += extra - history -> size;
+      extra = history -> size;
+    }
+    while(extra-- > 0)
+      memset_word(history_row(history, history -> head++), BLANK_CELL, NUM_COLS);
+
+    /* a display scrolled back keeps showing the same rows */
+    if(screen -> view) {
+      screen -> view += rows;
+      if(screen -> view > (int) history -> size) screen -> view = history -> size;
+    }
   }
+
+  if(rows > NUM_ROWS) rows = NUM_ROWS;
+  memmove_word(cells, cells + rows * NUM_COLS, (NUM_ROWS - rows) * NUM_COLS);
+  memset_word(cells + (NUM_ROWS - rows) * NUM_COLS, BLANK_CELL, rows * NUM_COLS);
+  screen -> dirty = (screen -> dirty >> rows) | (ALL_ROWS & ~(ALL_ROWS >> rows));
+  screen -> scrolled += rows;
+  restore_flags(flags);
 }
 
 /*
@@ -393,6 +687,7 @@ putc_in_terminal(uint8_t c, screen_t * screen)
     } else {
         *(uint8_t *)(screen -> video_mem + ((NUM_COLS* (screen -> y) + screen -> x) << 1)) = c;
         *(uint8_t *)(screen -> video_mem + ((NUM_COLS* (screen -> y) + screen -> x) << 1) + 1) = ATTRIB;
+        mark_rows(screen, screen -> y, screen -> y);
         screen -> x++;
         if(screen -> x > NUM_COLS - 1) increment_y = 1;
         screen -> x %= NUM_COLS;
@@ -406,6 +701,87 @@ putc_in_terminal(uint8_t c, screen_t * screen)
     }
 }
 
+/*
+* void write_in_terminal
+*   Inputs: buf - the characters to print
+*           n - number of characters in buf
+*           screen - a pointer to a specific screen
+*   Return Value: void
+*	Function: Output a buffer to the specified screen like putc_in_terminal
+*             does for each character, writing each run of characters up to
+*             a newline or the end of a row as character/attribute words.
+*             The buffer is drawn a chunk at a time with interrupts off, so
+*             keyboard echo can't move the cursor mid-chunk. Each chunk
+*             scrolls the screen once, up front, by every row it needs, and
+*             rows that would scroll off again are drawn straight into the
+*             history.
+*/
+void
+write_in_terminal(const uint8_t * buf, int32_t n, screen_t * screen)
+{
+    uint16_t * cell;
+    uint32_t flags;
+    int32_t i, run, len, x, y, rows, first;
+
+    while(n > 0) {
+        len = (n < WRITE_CHUNK) ? n : WRITE_CHUNK;
+        n -= len;
+
+        cli_and_save(flags);
+
+        /* count the rows the chunk moves down by */
+        rows = 0;
+        x = screen -> x;
+        for(i = 0; i < len; i++) {
+            if(buf[i] == '\n' || buf[i] == '\r' || ++x == NUM_COLS) {
+                rows++;
+                x = 0;
+            }
+        }
+
+        /* rows above the screen (y < 0) are in the history, or skipped if
+         * it does not keep them. Only the local y goes negative */
+        x = screen -> x;
+        y = screen -> y;
+        if(y + rows > NUM_ROWS - 1) {
+            scroll_in_terminal(screen, y + rows - (NUM_ROWS - 1));
+            y = NUM_ROWS - 1 - rows;
+        }
+        first = y;
+
+        while(len > 0) {
+            if(*buf != '\n' && *buf != '\r') {
+                run = NUM_COLS - x;
+                if(run > len) run = len;
+
+                cell = text_row(screen, y);
+                if(cell != NULL) cell += x;
+                for(i = 0; i < run && buf[i] != '\n' && buf[i] != '\r'; i++) {
+                    if(cell != NULL) cell[i] = (ATTRIB << 8) | buf[i];
+                }
+
+                buf += i;
+                len -= i;
+                x += i;
+                if(x < NUM_COLS) continue;
+            } else {
+                buf++;
+                len--;
+            }
+
+            /* newline, or the row is full */
+            x = 0;
+            y++;
+        }
+
+        screen -> x = x;
+        screen -> y = y;
+        mark_rows(screen, first, y);
+
+        restore_flags(flags);
+    }
+}
+
 /*
 * int8_t* itoa(uint32_t value, int8_t* buf, int32_t radix);
 *   Inputs: uint32_t value = number to convert
@@ -677,6 +1053,41 @@ memmove(void* dest, const void* src, uint32_t n)
 	return dest;
 }
 
+/*
+* void* memmove_word(void* dest, const void* src, uint32_t n);
+*   Inputs: void* dest = destination of move
+*			const void* src = source of move
+*			uint32_t n = number of 16-bit words to move
+*   Return Value: pointer to dest
+*	Function: move n words of src to dest, the areas may overlap
+*/
+
+void*
+memmove_word(void* dest, const void* src, uint32_t n)
+{
+	void * d = dest;
+
+	asm volatile("                  \n\
+			movw    %%ds, %%dx      \n\
+			movw    %%dx, %%es      \n\
+			cld                     \n\
+			cmp     %%edi, %%esi    \n\
+			jae     1f              \n\
+			leal    -2(%%esi, %%ecx, 2), %%esi    \n\
+			leal    -2(%%edi, %%ecx, 2), %%edi    \n\
+			std                     \n\
+			1:                      \n\
+			rep     movsw           \n\
+			cld                     \n\
+			"
+			: "+D"(d), "+S"(src), "+c"(n)
+			:
+			: "edx", "memory", "cc"
+			);
+
+	return dest;
+}
+
 /*
 * int32_t strncmp(const int8_t* s1, const int8_t* s2, uint32_t n)
 *   Inputs: const int8_t* s1 = first string to compare
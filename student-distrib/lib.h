@@ -9,24 +9,53 @@
 
 #define VIDEO 0xB8000
 
+/* VGA text memory, the screen on display scrolls through all of it by
+ * moving the VGA start address */
+#define VIDEO_SIZE 0x8000
+
+/* rows of 80 cells that fit in a 4 KB page, and the most pages a
+ * scrollback history can have */
+#define HISTORY_PAGE_ROWS	25
+#define HISTORY_MAX_PAGES	40
+
+/* rows that scrolled off the top of a screen, a ring of 'size' rows spread
+ * over pages of HISTORY_PAGE_ROWS rows */
+typedef struct {
+	uint16_t * pages[HISTORY_MAX_PAGES];
+	uint32_t size;
+	uint32_t head;		/* rows ever added, the newest is row head - 1 */
+} history_t;
+
+/* a terminal screen. Its cells live in RAM, flush_screen copies the rows
+ * that changed to VGA memory while the screen is on display. */
 typedef struct {
 	int x;
 	int y;
-	char * video_mem;
+	char * video_mem;	/* 80x25 cells in RAM */
+	uint32_t dirty;		/* rows changed since the last flush, bit n for row n */
+	int scrolled;		/* rows scrolled since the last flush */
+	history_t * history;	/* NULL if rows scrolled off are dropped */
+	int view;			/* rows of history the display is scrolled back by */
 } screen_t;
 
 int32_t printf(int8_t *format, ...);
 void putc(uint8_t c);
 void putc_in_terminal(uint8_t c, screen_t * screen);
+void write_in_terminal(const uint8_t * buf, int32_t n, screen_t * screen);
 int32_t puts(int8_t *s);
 int8_t *itoa(uint32_t value, int8_t* buf, int32_t radix);
 int8_t *strrev(int8_t* s);
 uint32_t strlen(const int8_t* s);
 void clear(void);
 void clear_terminal(screen_t * screen);
-void move_cursor(int32_t term_num, screen_t * screen, uint32_t term_mem_length);
+void show_screen(screen_t * screen);
+void flush_screen(screen_t * screen);
+void touch_screen(screen_t * screen);
+void move_cursor(screen_t * screen);
 void vert_scroll(void);
 void vert_scroll_in_terminal(screen_t * screen);
+void scroll_in_terminal(screen_t * screen, int32_t rows);
+void scroll_view(screen_t * screen, int32_t rows);
 void backspace_fnc(screen_t * screen);
 void test_interrupts(void);
 void* memset(void* s, int32_t c, uint32_t n);
@@ -34,6 +63,7 @@ void* memset_word(void* s, int32_t c, uint32_t n);
 void* memset_dword(void* s, int32_t c, uint32_t n);
 void* memcpy(void* dest, const void* src, uint32_t n);
 void* memmove(void* dest, const void* src, uint32_t n);
+void* memmove_word(void* dest, const void* src, uint32_t n);
 int32_t strncmp(const int8_t* s1, const int8_t* s2, uint32_t n);
 int8_t* strcpy(int8_t* dest, const int8_t*src);
 int8_t* strncpy(int8_t* dest, const int8_t*src, uint32_t n);
@@ -163,4 +193,16 @@ do {                                    \
 			);                      \
 } while(0)
 
+/* Compiler barrier
+ * Keeps the compiler from moving memory accesses across it, for data
+ * shared with interrupt handlers without disabling interrupts */
+#define barrier()                       \
+do {                                    \
+	asm volatile(""                     \
+			:                       \
+			:                       \
+			: "memory"              \
+			);                      \
+} while(0)
+
 #endif /* _LIB_H */
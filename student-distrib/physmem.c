@@ -0,0 +1,196 @@
+/* physmem.c - Bitmap allocator for physical page frames
+ * vim:ts=4 noexpandtab
+ */
+
+#include "physmem.h"
+#include "lib.h"
+
+#define CHECK_FLAG(flags,bit)	((flags) & (1 << (bit)))
+#define MBI_MEM_FLAG	0
+#define MBI_MODS_FLAG	3
+#define MBI_MMAP_FLAG	6
+#define MMAP_AVAILABLE	1
+
+#define HIGH_MEM_START	0x100000
+#define KB				1024
+
+#define BITS_PER_WORD	32
+#define MAP_WORDS		(NUM_FRAMES / BITS_PER_WORD)
+#define WORD_FULL		0xFFFFFFFF
+#define FRAME_BIT(f)	(1U << ((f) % BITS_PER_WORD))
+
+/* one bit per frame, set when the frame is in use or doesn't exist */
+static uint32_t frame_map[MAP_WORDS];
+static uint32_t free_count = 0;
+/* first word of the map that might have a free frame */
+static uint32_t next_word = 0;
+
+static void release_range(uint32_t start, uint32_t end);
+static void reserve_range(uint32_t start, uint32_t end);
+
+/*
+ * void physmem_init
+ *   Description: Marks every frame the multiboot memory map reports as
+ *           available RAM (and that lies in the frame region) as free.
+ *           Falls back to mem_upper if there is no memory map. Frames
+ *           holding boot modules stay reserved.
+ *   Inputs: mbi - the multiboot information structure
+ *   Outputs: none
+ *   Return Value: none
+ */
+void physmem_init(multiboot_info_t * mbi) {
+	memory_map_t * mmap;
+	module_t * mod;
+	uint32_t i;
+
+	/* everything is reserved until the bootloader says otherwise */
+	memset(frame_map, 0xFF, sizeof(frame_map));
+	free_count = 0;
+	next_word = 0;
+
+	if(CHECK_FLAG(mbi -> flags, MBI_MMAP_FLAG)) {
+		for(mmap = (memory_map_t *) mbi -> mmap_addr;
+				(uint32_t) mmap < mbi -> mmap_addr + mbi -> mmap_length;
+				mmap = (memory_map_t *) ((uint32_t) mmap + mmap -> size + sizeof(mmap -> size))) {
+			/* anything above 4 GB is out of reach anyway */
+			if(mmap -> type != MMAP_AVAILABLE || mmap -> base_addr_high)
+				continue;
+
+			if(mmap -> length_high || mmap -> base_addr_low + mmap -> length_low < mmap -> base_addr_low)
+				release_range(mmap -> base_addr_low, PHYS_MAP_END);
+			else
+				release_range(mmap -> base_addr_low, mmap -> base_addr_low + mmap -> length_low);
+		}
+	} else if(CHECK_FLAG(mbi -> flags, MBI_MEM_FLAG)) {
+		release_range(HIGH_MEM_START, HIGH_MEM_START + mbi -> mem_upper * KB);
+	}
+
+	/* the bootloader may load modules anywhere in available RAM */
+	if(CHECK_FLAG(mbi -> flags, MBI_MODS_FLAG)) {
+		mod = (module_t *) mbi -> mods_addr;
+		for(i = 0; i < mbi -> mods_count; i++)
+			reserve_range(mod[i].mod_start, mod[i].mod_end);
+	}
+}
+
+/*
+ * void release_range
+ *   Description: Marks the whole frames in [start, end) that lie in the
+ *           frame region as free.
+ *   Inputs: start - physical start address of the range
+ *           end - physical end address of the range
+ *   Outputs: none
+ *   Return Value: none
+ */
+static void release_range(uint32_t start, uint32_t end) {
+	uint32_t frame;
+
+	if(start < PHYS_MAP_START) start = PHYS_MAP_START;
+	if(end > PHYS_MAP_END) end = PHYS_MAP_END;
+	if(end <= start) return;
+
+	start = (start + FRAME_SIZE - 1) / FRAME_SIZE;
+	end /= FRAME_SIZE;
+
+	for(frame = start; frame < end; frame++) {
+		if(frame_map[frame / BITS_PER_WORD] & FRAME_BIT(frame)) {
+			frame_map[frame / BITS_PER_WORD] &= ~FRAME_BIT(frame);
+			free_count++;
+		}
+	}
+}
+
+/*
+ * void reserve_range
+ *   Description: Marks every frame that overlaps [start, end) and lies in
+ *           the frame region as in use.
+ *   Inputs: start - physical start address of the range
+ *           end - physical end address of the range
+ *   Outputs: none
+ *   Return Value: none
+ */
+static void reserve_range(uint32_t start, uint32_t end) {
+	uint32_t frame;
+
+	if(start < PHYS_MAP_START) start = PHYS_MAP_START;
+	if(end > PHYS_MAP_END) end = PHYS_MAP_END;
+	if(end <= start) return;
+
+	start /= FRAME_SIZE;
+	end = (end + FRAME_SIZE - 1) / FRAME_SIZE;
+
+	for(frame = start; frame < end; frame++) {
+		if(!(frame_map[frame / BITS_PER_WORD] & FRAME_BIT(frame))) {
+			frame_map[frame / BITS_PER_WORD] |= FRAME_BIT(frame);
+			free_count--;
+		}
+	}
+}
+
+/*
+ * uint32_t alloc_frame
+ *   Description: Allocates a 4 KB physical frame. The frame is not cleared.
+ *   Inputs: none
+ *   Outputs: none
+ *   Return Value: physical address of the frame, 0 if memory is exhausted
+ */
+uint32_t alloc_frame() {
+	uint32_t i, bit, flags;
+
+	cli_and_save(flags);
+
+	for(i = next_word; i < MAP_WORDS; i++) {
+		if(frame_map[i] != WORD_FULL) {
+			/* index of the first clear bit */
+			asm("bsfl %1, %0" : "=r" (bit) : "r" (~frame_map[i]));
+
+			frame_map[i] |= FRAME_BIT(bit);
+			free_count--;
+			next_word = i;
+
+			restore_flags(flags);
+			return (i * BITS_PER_WORD + bit) * FRAME_SIZE;
+		}
+	}
+
+	next_word = MAP_WORDS;
+	restore_flags(flags);
+	return 0;
+}
+
+/*
+ * void free_frame
+ *   Description: Returns a frame obtained from alloc_frame to the allocator.
+ *   Inputs: addr - physical address of the frame
+ *   Outputs: none
+ *   Return Value: none
+ */
+void free_frame(uint32_t addr) {
+	uint32_t frame, flags;
+
+	if(addr < PHYS_MAP_START || addr >= PHYS_MAP_END) return;
+
+	frame = addr / FRAME_SIZE;
+
+	cli_and_save(flags);
+
+	if(frame_map[frame / BITS_PER_WORD] & FRAME_BIT(frame)) {
+		frame_map[frame / BITS_PER_WORD] &= ~FRAME_BIT(frame);
+		free_count++;
+		if(frame / BITS_PER_WORD < next_word)
+			next_word = frame / BITS_PER_WORD;
+	}
+
+	restore_flags(flags);
+}
+
+/*
+ * uint32_t free_frame_count
+ *   Description: Returns how many frames can still be allocated.
+ *   Inputs: none
+ *   Outputs: none
+ *   Return Value: number of free frames
+ */
+uint32_t free_frame_count() {
+	return free_count;
+}
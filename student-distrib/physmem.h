@@ -0,0 +1,31 @@
+/* physmem.h - Defines for the physical page frame allocator
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _PHYSMEM_H
+#define _PHYSMEM_H
+
+#include "types.h"
+#include "multiboot.h"
+
+/* frames are handed out from the memory between the kernel and the user
+ * program region, which every page directory maps 1:1 for the kernel */
+#define PHYS_MAP_START	0x800000
+#define PHYS_MAP_END	0x8000000
+
+#define FRAME_SIZE		4096
+#define NUM_FRAMES		(PHYS_MAP_END / FRAME_SIZE)
+
+/* seed the allocator from the multiboot memory map */
+void physmem_init(multiboot_info_t * mbi);
+
+/* allocate a 4 KB frame, returns its physical address or 0 */
+uint32_t alloc_frame();
+
+/* return a frame to the allocator */
+void free_frame(uint32_t addr);
+
+/* number of frames that can still be allocated */
+uint32_t free_frame_count();
+
+#endif /* _PHYSMEM_H */
@@ -1,17 +1,25 @@
 #include "process.h"
 #include "lib.h"
 #include "virtualmem.h"
+#include "sys_calls.h"
 #include "x86_desc.h"
+#include "slab.h"
 
 #define MAX_DEVICES		6
 
 static uint32_t proc_count = 0;
+static uint32_t proc_max = MAX_PROCESSES;
 static uint8_t procs[MAX_PROCESSES] = {0};
-static uint32_t pd[MAX_PROCESSES][TABLE_SIZE] __attribute__((aligned (PAGE_SIZE)));
 static int32_t active_processes[MAX_TERMINALS] = {-1, -1, -1};
 
 static fops_t * devices[MAX_DEVICES];
 
+static slab_cache_t pcb_cache;
+static slab_cache_t files_cache;
+
+/* the pcb pointer at the base of the kernel stack of 'pid' */
+#define STACK_PCB(pid)	((pcb_t **) (KERNEL_MEM_END - KERNEL_STACK_SIZE * ((pid) + 1)))
+
 /* add_device
  *	  DESCRIPTION: Registers a device by adding it to the 'devices' array of fops_t*.
  *				   Once a device/file is registered, it can be used by a user program.
@@ -39,15 +47,113 @@ fops_t * get_device_fops(uint32_t ftype) {
 	return devices[ftype];
 }
 
+/* process_init
+ *	  DESCRIPTION: sets up the pcb and fd table caches and limits the number
+ *				   of processes so that their kernel stacks, which grow down
+ *				   from the end of the kernel page, stay above the kernel
+ *				   image and the boot modules.
+ *    INPUTS: mem_end - first address the kernel stacks may not touch
+ *    OUTPUTS: none
+ *    RETURN VALUE: none
+ */
+void process_init(uint32_t mem_end) {
+	uint32_t slots;
+
+	/* slot 0 is the boot stack */
+	slots = mem_end < KERNEL_MEM_END ? (KERNEL_MEM_END - mem_end) / KERNEL_STACK_SIZE : 0;
+	proc_max = slots > 1 ? slots - 1 : 0;
+	if(proc_max > MAX_PROCESSES) proc_max = MAX_PROCESSES;
+
+	slab_cache_init(&pcb_cache, "pcb", sizeof(pcb_t), 0);
+	slab_cache_init(&files_cache, "fd table", sizeof(fd_t) * FILE_ARRAY_LEN, 0);
+
+	/* the boot stack belongs to no process */
+	*STACK_PCB(0) = NULL;
+}
+
+/* pcb_alloc
+ *	  DESCRIPTION: allocates a cleared pcb and fd table for a process and
+ *				   stores the pcb pointer at the base of its kernel stack.
+ *    INPUTS: pid - the process id the pcb is for
+ *    OUTPUTS: none
+ *    RETURN VALUE: pointer to the pcb, NULL if memory is exhausted.
+ */
+pcb_t * pcb_alloc(int32_t pid) {
+	pcb_t * pcb;
+	fd_t * files;
+
+	pcb = slab_alloc(&pcb_cache);
+	files = slab_alloc(&files_cache);
+	if(pcb == NULL || files == NULL) {
+		slab_free(&pcb_cache, pcb);
+		slab_free(&files_cache, files);
+		return NULL;
+	}
+
+	memset(pcb, 0, sizeof(pcb_t));
+	memset(files, 0, sizeof(fd_t) * FILE_ARRAY_LEN);
+	pcb -> files = files;
+	pcb -> pid = pid;
+
+	*STACK_PCB(pid) = pcb;
+	return pcb;
+}
+
+/* pcb_free
+ *	  DESCRIPTION: returns a pcb and its fd table to their caches so the
+ *				   next process can reuse them.
+ *    INPUTS: pcb - the pcb to free
+ *    OUTPUTS: none
+ *    RETURN VALUE: none
+ */
+void pcb_free(pcb_t * pcb) {
+	if(pcb == NULL) return;
+
+	if(*STACK_PCB(pcb -> pid) == pcb)
+		*STACK_PCB(pcb -> pid) = NULL;
+
+	slab_free(&files_cache, pcb -> files);
+	slab_free(&pcb_cache, pcb);
+}
+
+/* get_pcb
+ *	  DESCRIPTION: gets the pcb of a process from the base of its kernel stack.
+ *    INPUTS: pid - the process id
+ *    OUTPUTS: none
+ *    RETURN VALUE: pointer to the pcb, NULL if there is no such process.
+ */
+pcb_t * get_pcb(int32_t pid) {
+	if(pid <= 0 || pid > proc_max) return NULL;
+
+	return *STACK_PCB(pid);
+}
+
+/* stack_pcb
+ *	  DESCRIPTION: gets the pcb at the base of the kernel stack an address is
+ *				   on, like the pcb() macro but safe on any stack.
+ *    INPUTS: esp - a stack pointer
+ *    OUTPUTS: none
+ *    RETURN VALUE: pointer to the pcb, NULL if esp is not on the kernel stack
+ *				   of a process.
+ */
+pcb_t * stack_pcb(uint32_t esp) {
+	/* slot 0, the boot stack, has no pcb */
+	if(esp >= KERNEL_MEM_END - KERNEL_STACK_SIZE ||
+			esp < KERNEL_MEM_END - KERNEL_STACK_SIZE * (proc_max + 1))
+		return NULL;
+
+	return *((pcb_t **) (esp & PCB_MASK));
+}
+
 /* add_process
  *	  DESCRIPTION: adds a process to the 'procs' bitmap array.
  *    INPUTS: none
- *    OUTPUTS: adds the pid (1-6) of the new process to the 'procs' array.
+ *    OUTPUTS: adds the pid of the new process to the 'procs' array.
  *    RETURN VALUE: process id number or -1 on failure.
  */
 int32_t add_process(){
 	uint32_t i;
-	for(i = 0; i < MAX_PROCESSES; i++){
+	for(i = 0; i < proc_max; i++){
 		if(procs[i] == 0){
 			procs[i] = 1;
 			proc_count++;
@@ -73,21 +179,6 @@ int32_t delete_process(int32_t pid){
 	return 0;
 }
 
-/* get_processes_pd
- *	  DESCRIPTION: gets a pointer to the page directory corresponding
- *				   to the pid of the specified process. 
- *    INPUTS: pid - process id the the page directory to get.
- *    OUTPUTS: none
- *    RETURN VALUE: pointer to the page directory.
- */
-uint32_t * get_process_pd(int32_t pid) {
-	pid--;
-	if(pid < 0 || pid >= MAX_PROCESSES) {
-		return NULL;
-	}
-	return pd[pid];
-}
-
 /* processes
  *	  DESCRIPTION: returns the total number of processes running.
  *    INPUTS: none
@@ -104,11 +195,11 @@ int32_t processes() {
  *    INPUTS: none
  *    OUTPUTS: none
  *    RETURN VALUE: 1 if total processes is less than the max amount
- *					of processes allowed (6). 0 if another process
+ *					of processes allowed. 0 if another process
  *					cannot be added.
  */
 int32_t free_procs() {
-	return proc_count < MAX_PROCESSES;
+	return proc_count < proc_max;
 }
 
 /* get_active_processes
@@ -5,16 +5,27 @@
 #include "types.h"
 #include "devices/keyboard.h"
 
-#define MAX_PROCESSES   6
+/* each process has an 8 KB kernel stack below the end of the kernel page,
+ * process_init lowers the limit if the stacks would reach the modules */
+#define MAX_PROCESSES   96
 
+#define PROG_VM_START    0x8000000
 #define PROG_VIDMEM_ADDR 0x8400000
+#define SPACE_4MB        0x400000
+#define START_EXE_ADDR   0x08048000
 
 #define FILE_ARRAY_LEN	8
 #define PCB_MASK        0xFFFFE000
 #define ARGS_MAX        128
 
+/* process states */
+#define PROC_READY      0   /* on the run queue */
+#define PROC_RUNNING    1   /* owns the processor */
+#define PROC_BLOCKED    2   /* asleep or waiting for a child */
+
 /* fd flags */
 #define FD_LIVE            0x1
+#define FD_NONBLOCK        0x2  /* reads return instead of waiting */
 
 /* fd struct
  * Used in pcb_t struct. Contains important
@@ -27,11 +38,13 @@ typedef struct {
     uint32_t inode_num;
     uint32_t pos;
     uint32_t flags;
+    void * private_data;  /* state the driver keeps for this open file */
 } fd_t;
 
 /* context struct
  * Used in pcb_t struct. Contains important
  * register values to remember for context switching.
+ * sched_asm.S depends on the order of esp and eip.
  */
 typedef struct {
     uint32_t esp, eip, esp0, ebp;
@@ -39,10 +52,12 @@ typedef struct {
 
 /* pcb struct
  * Contains important values for each process
- * to help with context switching.
+ * to help with context switching. PCBs and their fd tables come from
+ * slab caches, the base of the process' kernel stack holds a pointer
+ * to its pcb.
  */
 typedef struct pcb {
-	fd_t files[FILE_ARRAY_LEN];
+	fd_t * files;
     uint8_t args[ARGS_MAX];
     uint32_t args_len;
 	int32_t pid;
@@ -50,7 +65,13 @@ typedef struct pcb {
     context_t context;
     uint32_t esp_parent, ebp_parent;
     uint32_t * pd;
+    uint32_t * pt;
+    uint32_t image_inode, image_len;
     int32_t term_num;
+    int32_t state;
+    int32_t nice, boost;
+    uint32_t ready_tick;
+    struct pcb * next_ready, * prev_ready;
 } pcb_t;
 
 /* Registers a device by adding it to the 'devices' array of fops_t*.
@@ -66,9 +87,20 @@ int32_t add_process();
 /* deletes a process if the 'procs' array. */
 int32_t delete_process(int32_t pid);
 
-/* gets a pointer to the page directory corresponding
- * to the pid of the specified process. */
-uint32_t * get_process_pd(int32_t pid);
+/* limits the number of processes so kernel stacks stay above 'mem_end' */
+void process_init(uint32_t mem_end);
+
+/* allocates a cleared pcb and fd table for 'pid' and links it to its stack */
+pcb_t * pcb_alloc(int32_t pid);
+
+/* returns a pcb and its fd table to their caches */
+void pcb_free(pcb_t * pcb);
+
+/* gets the pcb of the process 'pid' */
+pcb_t * get_pcb(int32_t pid);
+
+/* gets the pcb of the process whose kernel stack 'esp' is on */
+pcb_t * stack_pcb(uint32_t esp);
 
 /* indicates if theres enough space in memory to add a new process */
 int32_t processes();
@@ -100,14 +132,14 @@ do {                        \
     );                      \
 } while(0)
 
-/* macro to get the pointer to the pbc that the current
- * esp is pointing to.
+/* macro to get the pointer to the pbc of the kernel stack
+ * the current esp is pointing to.
  */
 #define pcb(x)                          \
 do {                                    \
     uint32_t esp;                       \
     get_esp(esp);                       \
-    x = (pcb_t *) (esp & PCB_MASK);     \
+    x = *((pcb_t **) (esp & PCB_MASK)); \
 } while(0)
 
 #endif /* _PROCESS_H */
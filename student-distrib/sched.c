@@ -0,0 +1,506 @@
+/* sched.c - Scheduler, context switching and wait queues
+ * vim:ts=4 noexpandtab
+ */
+
+#include "sched.h"
+#include "lib.h"
+#include "process.h"
+#include "sys_calls.h"
+#include "virtualmem.h"
+#include "x86_desc.h"
+#include "devices/keyboard.h"
+#include "timer.h"
+#include "devices/pit.h"
+
+#define WORD_SIZE		4
+
+/* priority levels, 0 runs first */
+#define PRIO_LEVELS		8
+#define PRIO_BASE		4	/* level of a nice 0 process */
+#define FG_BOOST		1	/* processes of the terminal on screen */
+#define INPUT_BOOST		2	/* processes woken by keyboard input */
+#define AGE_TICKS		8	/* ticks a ready process waits before moving up a level */
+
+/* switches kernel threads, see sched_asm.S */
+extern void context_switch(context_t * prev, context_t * next);
+
+static void run_next(pcb_t * prev, context_t * save);
+static void wake_up_common(wait_queue_t * wq, int32_t boost);
+static int32_t effective_prio(pcb_t * pcb);
+static void enqueue(pcb_t * pcb);
+static pcb_t * dequeue();
+static void list_add_tail(pcb_t ** head, pcb_t * pcb);
+static void list_del(pcb_t ** head, pcb_t * pcb);
+static void launch();
+
+/* a circular list of ready processes per priority level, the head of
+ * each list runs next. Bit n of ready_map is set when level n is not empty. */
+static pcb_t * run_queue[PRIO_LEVELS];
+static uint32_t ready_map = 0;
+
+/* timer ticks since boot */
+static uint32_t ticks = 0;
+
+/* index of the lowest set bit of a non zero word */
+#define first_bit(x, word)				\
+do {									\
+	asm("bsfl %1, %0"					\
+		: "=r" (x)						\
+		: "rm" (word)					\
+		: "cc"							\
+	);									\
+} while(0)
+
+/* base program waiting to be started and its terminal */
+static uint8_t * next_execute = NULL;
+static int32_t next_execute_term = 0;
+
+/* base programs are started on a stack of their own, so the process that
+ * was running keeps a context it can be continued from. The first word
+ * is the (NULL) pcb pointer of the stack. */
+static uint8_t launch_stack[KERNEL_STACK_SIZE] __attribute__((aligned (KERNEL_STACK_SIZE)));
+static context_t launch_context;
+static context_t launch_save;
+
+/* set while waiting for an interrupt with nothing to run */
+static volatile int32_t idling = 0;
+
+/*
+ * void init_wait_queue
+ *   Description: Initializes an empty wait queue.
+ *   Inputs: wq - the wait queue
+ *   Outputs: none
+ *   Return Value: none
+ */
+void init_wait_queue(wait_queue_t * wq) {
+	wq -> head = NULL;
+}
+
+/*
+ * void add_wait_queue
+ *   Description: Puts an entry at the head of a wait queue.
+ *   Inputs: wq - the wait queue
+ *           entry - the entry to add, with its pcb set
+ *   Outputs: none
+ *   Return Value: none
+ */
+void add_wait_queue(wait_queue_t * wq, wait_entry_t * entry) {
+	uint32_t flags;
+
+	cli_and_save(flags);
+
+	entry -> prev = NULL;
+	entry -> next = wq -> head;
+	if(wq -> head != NULL) wq -> head -> prev = entry;
+	wq -> head = entry;
+
+	restore_flags(flags);
+}
+
+/*
+ * void remove_wait_queue
+ *   Description: Takes an entry off the wait queue it is on.
+ *   Inputs: wq - the wait queue
+ *           entry - the entry to remove
+ *   Outputs: none
+ *   Return Value: none
+ */
+void remove_wait_queue(wait_queue_t * wq, wait_entry_t * entry) {
+	uint32_t flags;
+
+	cli_and_save(flags);
+
+	if(entry -> prev != NULL) entry -> prev -> next = entry -> next;
+	else wq -> head = entry -> next;
+	if(entry -> next != NULL) entry -> next -> prev = entry -> prev;
+
+	restore_flags(flags);
+}
+
+/*
+ * void sleep_on
+ *   Description: Blocks the current process on a wait queue and runs
+ *           other processes until it is woken up. Callers check their
+ *           condition with interrupts disabled and sleep again while it
+ *           does not hold, so no wake up is missed.
+ *   Inputs: wq - the wait queue
+ *   Outputs: none
+ *   Return Value: none
+ */
+void sleep_on(wait_queue_t * wq) {
+	wait_entry_t entry;
+	pcb_t * pcb;
+
+	pcb(pcb);
+
+	entry.pcb = pcb;
+	add_wait_queue(wq, &entry);
+
+	pcb -> state = PROC_BLOCKED;
+	schedule();
+
+	remove_wait_queue(wq, &entry);
+}
+
+/*
+ * void poll_init
+ *   Description: Initializes a poll table that is on no wait queue.
+ *   Inputs: table - the poll table
+ *   Outputs: none
+ *   Return Value: none
+ */
+void poll_init(poll_table_t * table) {
+	table -> count = 0;
+}
+
+/*
+ * void poll_wait
+ *   Description: Puts the current process on one more wait queue of a
+ *           poll. It stays there until poll_free, so a process polling
+ *           several files is woken by any of them.
+ *   Inputs: table - the poll table, NULL when the caller only checks
+ *           wq - the wait queue
+ *   Outputs: none
+ *   Return Value: none
+ */
+void poll_wait(poll_table_t * table, wait_queue_t * wq) {
+	wait_entry_t * entry;
+
+	if(table == NULL || table -> count >= POLL_MAX_WAITS) return;
+
+	entry = &table -> entries[table -> count];
+	pcb(entry -> pcb);
+	add_wait_queue(wq, entry);
+	table -> queues[table -> count++] = wq;
+}
+
+/*
+ * void poll_free
+ *   Description: Takes the current process off all wait queues of a poll.
+ *   Inputs: table - the poll table
+ *   Outputs: none
+ *   Return Value: none
+ */
+void poll_free(poll_table_t * table) {
+	int32_t i;
+
+	for(i = 0; i < table -> count; i++)
+		remove_wait_queue(table -> queues[i], &table -> entries[i]);
+	table -> count = 0;
+}
+
+/*
+ * void wake_up
+ *   Description: Puts every process blocked on a wait queue back on the
+ *           run queue. Safe to call from interrupt handlers.
+ *   Inputs: wq - the wait queue
+ *   Outputs: none
+ *   Return Value: none
+ */
+void wake_up(wait_queue_t * wq) {
+	wake_up_common(wq, 0);
+}
+
+/*
+ * void wake_up_interactive
+ *   Description: Wakes a wait queue like wake_up, and boosts the priority
+ *           of the woken processes until their next time slice ends, so
+ *           input is echoed quickly.
+ *   Inputs: wq - the wait queue
+ *   Outputs: none
+ *   Return Value: none
+ */
+void wake_up_interactive(wait_queue_t * wq) {
+	wake_up_common(wq, 1);
+}
+
+/*
+ * void wake_up_common
+ *   Description: Puts the blocked processes of a wait queue on the run queue.
+ *   Inputs: wq - the wait queue
+ *           boost - whether the woken processes get the input boost
+ *   Outputs: none
+ *   Return Value: none
+ */
+static void wake_up_common(wait_queue_t * wq, int32_t boost) {
+	wait_entry_t * entry;
+	uint32_t flags;
+
+	cli_and_save(flags);
+
+	for(entry = wq -> head; entry != NULL; entry = entry -> next) {
+		if(entry -> pcb -> state == PROC_BLOCKED) {
+			entry -> pcb -> state = PROC_READY;
+			if(boost) entry -> pcb -> boost = 1;
+			enqueue(entry -> pcb);
+		}
+	}
+
+	restore_flags(flags);
+}
+
+/*
+ * void schedule
+ *   Description: Puts the current process at the back of the run queue,
+ *           unless it blocked, and gives the processor to the first process
+ *           of the best priority level, or starts a scheduled base program. Returns once
+ *           the current process runs again.
+ *   Inputs: none
+ *   Outputs: none
+ *   Return Value: none
+ */
+void schedule() {
+	pcb_t * prev;
+	uint32_t flags;
+
+	cli_and_save(flags);
+
+	pcb(prev);
+
+	/* a tick while idling, the idle loop picks the next process itself */
+	if(!idling && prev != NULL)
+		run_next(prev, &prev -> context);
+
+	restore_flags(flags);
+}
+
+/*
+ * void sched_tick
+ *   Description: Counts a timer tick and moves the process that has waited
+ *           longest on each priority level up a level once it has waited
+ *           AGE_TICKS, so low priority processes are not starved.
+ *   Inputs: none
+ *   Outputs: none
+ *   Return Value: none
+ */
+void sched_tick() {
+	int32_t i;
+	pcb_t * pcb;
+	uint32_t flags;
+
+	cli_and_save(flags);
+
+	ticks++;
+
+	for(i = 1; i < PRIO_LEVELS; i++) {
+		pcb = run_queue[i];
+		if(pcb != NULL && ticks - pcb -> ready_tick >= AGE_TICKS) {
+			list_del(&run_queue[i], pcb);
+			if(run_queue[i] == NULL) ready_map &= ~(1 << i);
+
+			list_add_tail(&run_queue[i - 1], pcb);
+			ready_map |= 1 << (i - 1);
+			pcb -> ready_tick = ticks;
+		}
+	}
+
+	restore_flags(flags);
+}
+
+/*
+ * void preempt_check
+ *   Description: Switches away from the current process right away if a
+ *           ready process has a better priority, instead of waiting for
+ *           the end of the time slice.
+ *   Inputs: none
+ *   Outputs: none
+ *   Return Value: none
+ */
+void preempt_check() {
+	pcb_t * pcb;
+	int32_t prio;
+	uint32_t flags;
+
+	cli_and_save(flags);
+
+	pcb(pcb);
+
+	if(!idling && pcb != NULL && pcb -> state == PROC_RUNNING && ready_map) {
+		first_bit(prio, ready_map);
+		if(prio < effective_prio(pcb))
+			schedule();
+	}
+
+	restore_flags(flags);
+}
+
+/*
+ * void schedule_for_execution
+ *   Description: Schedules a base program to be started on a terminal the
+ *           next time the scheduler runs.
+ *   Inputs: command - the command to execute, must outlive the call
+ *           term_num - the terminal to run the command on
+ *   Outputs: none
+ *   Return Value: none
+ */
+void schedule_for_execution(uint8_t * command, int32_t term_num) {
+	next_execute_term = term_num;
+	next_execute = command;
+}
+
+/*
+ * void run_next
+ *   Description: Switches to the launcher if a base program is scheduled,
+ *           otherwise to the best ready process. Halts
+ *           the processor until an interrupt when nothing is ready.
+ *   Inputs: prev - the current process, NULL on the launcher stack
+ *           save - where to save the current context
+ *   Outputs: none
+ *   Return Value: none
+ */
+static void run_next(pcb_t * prev, context_t * save) {
+	pcb_t * next;
+
+	/* a preempted process waits its turn again, without its input boost */
+	if(prev != NULL && prev -> state == PROC_RUNNING) {
+		prev -> state = PROC_READY;
+		prev -> boost = 0;
+		enqueue(prev);
+	}
+
+	while(1) {
+		if(next_execute != NULL) {
+			/* a fake return address for launch on top of its stack */
+			launch_context.esp = (uint32_t) launch_stack + KERNEL_STACK_SIZE - WORD_SIZE;
+			launch_context.eip = (uint32_t) launch;
+			context_switch(save, &launch_context);
+			return;
+		}
+
+		next = dequeue();
+		if(next != NULL) {
+			next -> state = PROC_RUNNING;
+			if(next != prev) {
+				set_pd(next -> pd);
+				tss.esp0 = next -> context.esp0;
+				context_switch(save, &(next -> context));
+			}
+			return;
+		}
+
+		/* nothing to run, wait for an interrupt to wake something up
+		 * without taking timer ticks that have nothing to do */
+		idling = 1;
+		pit_tick_stop(timer_next_deadline());
+		asm volatile("sti; hlt; cli" : : : "memory", "cc");
+		pit_tick_resume();
+		idling = 0;
+	}
+}
+
+/*
+ * int32_t effective_prio
+ *   Description: Computes the priority level of a process from its nice
+ *           value and boosts for being on screen and for input.
+ *   Inputs: pcb - the process
+ *   Outputs: none
+ *   Return Value: the priority level, 0 is the best
+ */
+static int32_t effective_prio(pcb_t * pcb) {
+	int32_t prio = PRIO_BASE + pcb -> nice;
+
+	if(pcb -> term_num == get_current_terminal()) prio -= FG_BOOST;
+	if(pcb -> boost) prio -= INPUT_BOOST;
+
+	if(prio < 0) prio = 0;
+	if(prio >= PRIO_LEVELS) prio = PRIO_LEVELS - 1;
+	return prio;
+}
+
+/*
+ * void enqueue
+ *   Description: Puts a process at the back of the run queue of its
+ *           priority level. Called with interrupts disabled.
+ *   Inputs: pcb - the ready process
+ *   Outputs: none
+ *   Return Value: none
+ */
+static void enqueue(pcb_t * pcb) {
+	int32_t prio = effective_prio(pcb);
+
+	list_add_tail(&run_queue[prio], pcb);
+	ready_map |= 1 << prio;
+	pcb -> ready_tick = ticks;
+}
+
+/*
+ * pcb_t * dequeue
+ *   Description: Takes the process at the front of the best non empty
+ *           priority level off the run queue. Called with interrupts disabled.
+ *   Inputs: none
+ *   Outputs: none
+ *   Return Value: the process to run next, NULL if none is ready
+ */
+static pcb_t * dequeue() {
+	int32_t prio;
+	pcb_t * pcb;
+
+	if(!ready_map) return NULL;
+
+	first_bit(prio, ready_map);
+	pcb = run_queue[prio];
+
+	list_del(&run_queue[prio], pcb);
+	if(run_queue[prio] == NULL) ready_map &= ~(1 << prio);
+	return pcb;
+}
+
+/*
+ * void list_add_tail
+ *   Description: Adds a process at the back of a circular ready list.
+ *   Inputs: head - the head of the list
+ *           pcb - the process to add
+ *   Outputs: none
+ *   Return Value: none
+ */
+static void list_add_tail(pcb_t ** head, pcb_t * pcb) {
+	if(*head == NULL) {
+		pcb -> next_ready = pcb;
+		pcb -> prev_ready = pcb;
+		*head = pcb;
+	} else {
+		pcb -> next_ready = *head;
+		pcb -> prev_ready = (*head) -> prev_ready;
+		(*head) -> prev_ready -> next_ready = pcb;
+		(*head) -> prev_ready = pcb;
+	}
+}
+
+/*
+ * void list_del
+ *   Description: Takes a process off a circular ready list.
+ *   Inputs: head - the head of the list
+ *           pcb - the process to remove
+ *   Outputs: none
+ *   Return Value: none
+ */
+static void list_del(pcb_t ** head, pcb_t * pcb) {
+	if(pcb -> next_ready == pcb) {
+		*head = NULL;
+	} else {
+		pcb -> prev_ready -> next_ready = pcb -> next_ready;
+		pcb -> next_ready -> prev_ready = pcb -> prev_ready;
+		if(*head == pcb) *head = pcb -> next_ready;
+	}
+	pcb -> next_ready = NULL;
+	pcb -> prev_ready = NULL;
+}
+
+/*
+ * void launch
+ *   Description: Entry point of the launcher stack. Starts the scheduled
+ *           base program, which does not come back here unless it could
+ *           not be started.
+ *   Inputs: none
+ *   Outputs: none
+ *   Return Value: none
+ */
+static void launch() {
+	uint8_t * command = next_execute;
+
+	next_execute = NULL;
+	execute_on_terminal(command, next_execute_term);
+
+	/* nothing to come back to on this stack */
+	run_next(NULL, &launch_save);
+}
@@ -0,0 +1,81 @@
+/* sched.h - Defines for the scheduler and wait queues
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _SCHED_H
+#define _SCHED_H
+
+#include "types.h"
+
+/* range of nice values, lower runs first */
+#define NICE_MIN		-3
+#define NICE_MAX		3
+
+/* an entry on a wait queue, lives on the sleeping process' stack */
+typedef struct wait_entry {
+	struct pcb * pcb;
+	struct wait_entry * prev;
+	struct wait_entry * next;
+} wait_entry_t;
+
+/* a list of processes waiting for an event */
+typedef struct wait_queue {
+	wait_entry_t * head;
+} wait_queue_t;
+
+/* poll events */
+#define POLLIN			0x1		/* read won't block */
+#define POLLOUT			0x4		/* write won't block */
+#define POLLNVAL		0x20	/* fd is not open */
+
+/* wait queues a polling process waits on at once */
+#define POLL_MAX_WAITS	16
+
+/* the wait queues a polling process sleeps on, lives on its stack */
+typedef struct poll_table {
+	int32_t count;
+	wait_queue_t * queues[POLL_MAX_WAITS];
+	wait_entry_t entries[POLL_MAX_WAITS];
+} poll_table_t;
+
+/* empty a wait queue */
+void init_wait_queue(wait_queue_t * wq);
+
+/* put an entry on a wait queue */
+void add_wait_queue(wait_queue_t * wq, wait_entry_t * entry);
+
+/* take an entry off a wait queue */
+void remove_wait_queue(wait_queue_t * wq, wait_entry_t * entry);
+
+/* sleep on a wait queue until woken, call with interrupts disabled */
+void sleep_on(wait_queue_t * wq);
+
+/* start an empty poll table */
+void poll_init(poll_table_t * table);
+
+/* add the current process to a wait queue for a poll, does nothing if
+ * 'table' is NULL */
+void poll_wait(poll_table_t * table, wait_queue_t * wq);
+
+/* take the current process off every wait queue of a poll */
+void poll_free(poll_table_t * table);
+
+/* make every process on a wait queue runnable again */
+void wake_up(wait_queue_t * wq);
+
+/* wake up for user input, the woken processes get a priority boost */
+void wake_up_interactive(wait_queue_t * wq);
+
+/* count a timer tick and age the ready processes */
+void sched_tick();
+
+/* reschedule if a ready process outranks the current one */
+void preempt_check();
+
+/* switch to the next runnable process, idling if there is none */
+void schedule();
+
+/* start a command as a base program on a terminal at the next schedule */
+void schedule_for_execution(uint8_t * command, int32_t term_num);
+
+#endif /* _SCHED_H */
@@ -0,0 +1,104 @@
+/* slab.c - Free list caches for fixed size kernel objects
+ * vim:ts=4 noexpandtab
+ */
+
+#include "slab.h"
+#include "physmem.h"
+#include "lib.h"
+
+static int32_t slab_grow(slab_cache_t * cache);
+
+/*
+ * void slab_cache_init
+ *   Description: Initializes an empty cache. The object size is rounded up
+ *           to the alignment so every object in a frame stays aligned.
+ *   Inputs: cache - the cache to initialize
+ *           name - name of the cache, for debugging
+ *           size - size of one object in bytes (at most a frame)
+ *           align - alignment of the objects, a power of 2 (0 for CACHE_LINE)
+ *   Outputs: none
+ *   Return Value: none
+ */
+void slab_cache_init(slab_cache_t * cache, int8_t * name, uint32_t size, uint32_t align) {
+	if(align < CACHE_LINE) align = CACHE_LINE;
+
+	cache -> name = name;
+	cache -> obj_size = (size + align - 1) & ~(align - 1);
+	cache -> free_list = NULL;
+	cache -> in_use = 0;
+	cache -> total = 0;
+}
+
+/*
+ * int32_t slab_grow
+ *   Description: Takes a new frame from the frame allocator and threads
+ *           its objects onto the cache's free list.
+ *   Inputs: cache - the cache to grow
+ *   Outputs: none
+ *   Return Value: 0 on success, -1 if there are no free frames
+ */
+static int32_t slab_grow(slab_cache_t * cache) {
+	uint32_t frame, obj;
+
+	if(cache -> obj_size > FRAME_SIZE) return -1;
+
+	frame = alloc_frame();
+	if(!frame) return -1;
+
+	for(obj = frame; obj + cache -> obj_size <= frame + FRAME_SIZE; obj += cache -> obj_size) {
+		*((void **) obj) = cache -> free_list;
+		cache -> free_list = (void *) obj;
+		cache -> total++;
+	}
+	return 0;
+}
+
+/*
+ * void * slab_alloc
+ *   Description: Takes an object off the cache's free list, growing the
+ *           cache by a frame if the list is empty. Objects are not cleared.
+ *   Inputs: cache - the cache to allocate from
+ *   Outputs: none
+ *   Return Value: pointer to the object, NULL if memory is exhausted
+ */
+void * slab_alloc(slab_cache_t * cache) {
+	void * obj;
+	uint32_t flags;
+
+	cli_and_save(flags);
+
+	if(cache -> free_list == NULL && slab_grow(cache)) {
+		restore_flags(flags);
+		return NULL;
+	}
+
+	obj = cache -> free_list;
+	cache -> free_list = *((void **) obj);
+	cache -> in_use++;
+
+	restore_flags(flags);
+	return obj;
+}
+
+/*
+ * void slab_free
+ *   Description: Puts an object back on its cache's free list so the next
+ *           allocation from the cache reuses it.
+ *   Inputs: cache - the cache the object came from
+ *           obj - the object to free
+ *   Outputs: none
+ *   Return Value: none
+ */
+void slab_free(slab_cache_t * cache, void * obj) {
+	uint32_t flags;
+
+	if(obj == NULL) return;
+
+	cli_and_save(flags);
+
+	*((void **) obj) = cache -> free_list;
+	cache -> free_list = obj;
+	cache -> in_use--;
+
+	restore_flags(flags);
+}
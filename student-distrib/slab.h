@@ -0,0 +1,33 @@
+/* slab.h - Defines for the kernel object caches
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include "types.h"
+
+/* objects are aligned to cache lines unless a cache asks for more */
+#define CACHE_LINE		64
+
+/* a cache of equally sized objects carved out of page frames. Freed
+ * objects go on a free list and are handed out again before any new
+ * frame is taken from the frame allocator. */
+typedef struct slab_cache {
+	int8_t * name;
+	uint32_t obj_size;
+	void * free_list;
+	uint32_t in_use;
+	uint32_t total;
+} slab_cache_t;
+
+/* set up an empty cache of objects of 'size' bytes aligned to 'align' */
+void slab_cache_init(slab_cache_t * cache, int8_t * name, uint32_t size, uint32_t align);
+
+/* take an object from a cache, NULL if memory is exhausted */
+void * slab_alloc(slab_cache_t * cache);
+
+/* return an object to its cache */
+void slab_free(slab_cache_t * cache, void * obj);
+
+#endif /* _SLAB_H */
@@ -6,10 +6,8 @@
 #include "x86_desc.h"
 #include "devices/keyboard.h"
 #include "devices/pit.h"
-
-#define PROG_VM_START   0x8000000
-#define SPACE_4MB       0x400000
-#define START_EXE_ADDR  0x08048000
+#include "sched.h"
+#include "timer.h"
 
 #define ELF_HEADER_LEN  40
 #define ELF_MAGIC       0x464c457f
@@ -17,6 +15,13 @@
 
 #define WORD_SIZE       4
 
+/* loader modes: map the executable's filesystem blocks up front and copy
+ * each page on its first write, or map nothing and fault every page in
+ * when it is first touched */
+#define LOAD_MAP        1
+#define LOAD_DEMAND     2
+#define LOAD_MODE       LOAD_DEMAND
+
 /* trick to stringify macros */
 #define STR2(x)         #x
 #define STR(x)          STR2(x)
@@ -24,6 +29,19 @@
 /* helper function to parse args for execute */
 static void parse_arg(const uint8_t* command, uint8_t* command_buf, uint8_t * arg_buf);
 
+/* a poll timeout, set when its timer runs out */
+typedef struct poll_timeout {
+    int32_t expired;
+    wait_queue_t wait;
+} poll_timeout_t;
+
+/* helpers for poll */
+static int32_t poll_files(pcb_t * pcb, pollfd_t* fds, int32_t nfds, poll_table_t * table);
+static void poll_expire(void * data);
+
+/* loads and runs a program for execute, out of line so halt_ret_label is unique */
+static int32_t run_program(const uint8_t* command, pcb_t * parent, int32_t term_num) __attribute__((noinline));
+
 /*
 int32_t halt(uint8_t status)
 DESCRIPTION: terminates a process, returning to its parent process. 
@@ -41,11 +59,13 @@ SIDE EFFECTS:
 int32_t halt (uint8_t status) {
     pcb_t * pcb_child_ptr, * pcb_parent_ptr;
     uint32_t esp, ebp, i;
+    int32_t term_num;
 
     cli();
 
     pcb(pcb_child_ptr);
     pcb_parent_ptr = pcb_child_ptr -> parent_pcb;
+    term_num = pcb_child_ptr -> term_num;
 
     /*deletes corresponding process in the processes array*/
     delete_process(pcb_child_ptr -> pid);
@@ -60,18 +80,23 @@ int32_t halt (uint8_t status) {
     /*if this process is not the base shell change necessary values to switch to parent process*/
     if(pcb_parent_ptr != NULL) {
         set_pd(pcb_parent_ptr -> pd);
+        user_mem_free(pcb_child_ptr -> pd, pcb_child_ptr -> pt);
         tss.esp0 = pcb_parent_ptr -> context.esp0;
         set_active_process(pcb_parent_ptr -> term_num, pcb_parent_ptr -> pid);
+        pcb_parent_ptr -> state = PROC_RUNNING;
     } else {	//if the process is the base shell, execute new shell
         set_pd(NULL);
-        set_active_process(pcb_child_ptr -> term_num, -1);
+        user_mem_free(pcb_child_ptr -> pd, pcb_child_ptr -> pt);
+        pcb_free(pcb_child_ptr);
+        set_active_process(term_num, -1);
         while(1) {
-            execute((uint8_t *) "shell");
+            execute_on_terminal((uint8_t *) "shell", term_num);
         }
     }
     
     esp = pcb_child_ptr -> esp_parent;
     ebp = pcb_child_ptr -> ebp_parent;
+    pcb_free(pcb_child_ptr);
 	
     //returning the status in %bl and restoring %esp and %ebp to that of parents
     asm volatile("              \n\
@@ -102,6 +127,41 @@ RETURN VALUE:
 SIDE EFFECTS:
 */
 int32_t execute (const uint8_t* command) {
+    pcb_t * parent;
+
+    pcb(parent);
+
+    return run_program(command, parent, parent -> term_num);
+}
+
+/*
+int32_t execute_on_terminal(const uint8_t* command, int32_t term_num)
+DESCRIPTION: starts a base program, one without a parent process, on a terminal.
+INPUTS:
+	const uint8_t* command: program name and arguments, as for execute
+	int32_t term_num: the terminal the program runs on
+OUTPUTS: None
+RETURN VALUE: -1 if command cannot be executed, otherwise does not return
+	until the program halts
+SIDE EFFECTS:
+*/
+int32_t execute_on_terminal (const uint8_t* command, int32_t term_num) {
+    return run_program(command, NULL, term_num);
+}
+
+/*
+int32_t run_program(const uint8_t* command, pcb_t * parent, int32_t term_num)
+DESCRIPTION: loads a program and hands off the processor to it until it
+	halts. Kept out of line since halt jumps back to the label inside it.
+INPUTS:
+	const uint8_t* command: program name and arguments
+	pcb_t * parent: the process waiting for the program, NULL for a base program
+	int32_t term_num: the terminal the program runs on
+OUTPUTS: None
+RETURN VALUE: same as execute
+SIDE EFFECTS:
+*/
+static int32_t run_program (const uint8_t* command, pcb_t * parent, int32_t term_num) {
     int8_t retval = 0;
     uint8_t command_buf[ARGS_MAX];
     uint8_t args[ARGS_MAX];
@@ -115,9 +175,9 @@ int32_t execute (const uint8_t* command) {
     fd_t fd;
     uint32_t i;
     int32_t pid;
-    pcb_t* pcb_start;
     fops_t * term_fops;
     uint32_t * pd;
+    uint32_t * pt;
 
     cli();
 
@@ -133,27 +193,37 @@ int32_t execute (const uint8_t* command) {
         if(pid < 0)
             return -1;
 
+        /* the pcb, fd table, page directory and user page table all come
+         * from their caches */
+        pcb = pcb_alloc(pid);
+        pd = table_alloc();
+        pt = table_alloc();
+        if(pt != NULL) memset(pt, 0, PAGE_SIZE);
+        if(pcb == NULL || pd == NULL || pt == NULL) {
+            user_mem_free(pd, pt);
+            pcb_free(pcb);
+            delete_process(pid);
+            return -1;
+        }
+
         addr = *((uint32_t *) (buf + ELF_ADDR_OFFS));  /* interpret the 4 bytes at buf[24-27] as a uint32_t */
         vm_end = PROG_VM_START + SPACE_4MB - WORD_SIZE;
 
-        /* starting address of current pcb */
-        pcb(pcb_start);
-
         /* get terminal fops */
         term_fops = get_device_fops(TERM_FTYPE);
 
-        /* setting the pcb in the kernel stack */
-        pcb = (pcb_t*) (KERNEL_MEM_END - (pid + 1) * KERNEL_STACK_SIZE);
         stdin.fops = term_fops;
         stdin.inode = NULL;
         stdin.pos = 0;
         stdin.flags = FD_LIVE;
+        stdin.private_data = NULL;
         pcb->files[0] = stdin;
 
         stdout.fops = term_fops;
         stdout.inode = NULL;
         stdout.pos = 0;
         stdout.flags = FD_LIVE;
+        stdout.private_data = NULL;
         pcb->files[1] = stdout;
 
         /* initialize the rest of the file descriptor entries */
@@ -162,41 +232,42 @@ int32_t execute (const uint8_t* command) {
             fd.inode = NULL;
             fd.pos = 0;
             fd.flags = 0;
+            fd.private_data = NULL;
             pcb->files[i] = fd;
         }
 	
-	//if its not a new terminal, set parent pcb to the process that calls executable
-        pcb->pid = pid;
-        if(curr_terminal_running_process()) {
-            pcb -> parent_pcb = pcb_start;
-            pcb -> term_num = pcb_start -> term_num;
-        } else { //used when no shell on the terminal, sets up pcb for a base shell
-            pcb -> parent_pcb = NULL;
-            pcb -> term_num = get_current_terminal();
-        }
+        pcb -> parent_pcb = parent;
+        pcb -> term_num = term_num;
+        pcb -> state = PROC_RUNNING;
+        pcb -> nice = parent != NULL ? parent -> nice : 0;
        
-        /* set up process paging */
-        pd = get_process_pd(pid);
+        /* set up process paging, the user region gets 4 KB pages that are
+         * faulted in from the executable or zero filled when first touched */
+        pcb -> image_inode = dentry.inode;
+        pcb -> image_len = get_inode_ptr(dentry.inode) -> length;
         pd_init(pd, pcb -> term_num);
-        set_pde(pd, PROG_VM_START, KERNEL_MEM_END + (pid - 1) * SPACE_4MB,
-                FLAG_PS | FLAG_U | FLAG_WE | FLAG_P);
+        if(LOAD_MODE == LOAD_MAP)
+            load_mapped(&dentry, pt, (uint8_t *) START_EXE_ADDR);
+        set_pde(pd, PROG_VM_START, (uint32_t) pt, FLAG_U | FLAG_WE | FLAG_P);
         set_pd(pd);
 
         pcb -> args_len = strlen((int8_t *) args);
         strcpy((int8_t *) pcb -> args, (int8_t *) args);
 
         pcb -> pd = pd;
+        pcb -> pt = pt;
         pcb -> context.esp0 = KERNEL_MEM_END - KERNEL_STACK_SIZE * pid - WORD_SIZE;
 
         set_active_process(pcb -> term_num, pid);
 
+        /* the parent waits for the child off the run queue */
+        if(parent != NULL)
+            parent -> state = PROC_BLOCKED;
+
         /* saving values in tss to return to process kernel stack */
         tss.esp0 = pcb -> context.esp0;
         tss.ss0 = KERNEL_DS;
 
-        /* load file in physical memory */
-        load(&dentry, (uint8_t*) START_EXE_ADDR);
-
         get_ebp(pcb -> ebp_parent);
         get_esp(pcb -> esp_parent);
         
@@ -342,8 +413,17 @@ int32_t open (const uint8_t* filename){
     
     /*setting flags to make the file descriptor live*/
     fd_ptr -> fops = fops;
+    fd_ptr -> pos = 0;
     fd_ptr -> flags = FD_LIVE;
-    fd_ptr -> fops -> open(filename);
+    fd_ptr -> private_data = NULL;
+
+    /* give the descriptor back if the device can't open it */
+    if(fd_ptr -> fops -> open(fd, filename) == -1) {
+        fd_ptr -> fops = NULL;
+        fd_ptr -> inode = NULL;
+        fd_ptr -> flags = 0;
+        return -1;
+    }
 
     return fd;
 }
@@ -379,6 +459,7 @@ int32_t close (int32_t fd){
         file_desc -> inode = NULL;
         file_desc -> pos = 0;
         file_desc -> flags = 0;
+        file_desc -> private_data = NULL;
         return 0;
     }
 
@@ -434,6 +515,11 @@ int32_t vidmap (uint8_t** screen_start){
 
     pcb(pcb);
 
+    /* the program draws to the terminal's screen behind the display's
+       back, so the display refreshes it every tick */
+    get_terminal(pcb -> term_num) -> vidmap_owner = pcb;
+    request_flush();
+
     // set_pde_present(PROG_VIDMEM_ADDR);
     set_pde_flags(pcb -> pd, PROG_VIDMEM_ADDR, FLAG_P);
 
@@ -462,6 +548,197 @@ SIDE EFFECTS:
 */
 int32_t sigreturn (void){ return -1; }
 
+/*
+int32_t nice(int32_t inc)
+DESCRIPTION: changes the scheduling priority of the calling process
+INPUTS:
+	int32_t inc - amount to add to the nice value, negative values raise the priority
+OUTPUTS: none
+RETURN VALUE: the new nice value, clamped to NICE_MIN..NICE_MAX
+SIDE EFFECTS: takes effect the next time the process is queued to run,
+	children inherit the nice value
+*/
+int32_t nice (int32_t inc){
+    pcb_t * pcb;
+    int32_t value;
+
+    pcb(pcb);
+
+    value = pcb -> nice + inc;
+    if(value < NICE_MIN) value = NICE_MIN;
+    if(value > NICE_MAX) value = NICE_MAX;
+
+    pcb -> nice = value;
+    return value;
+}
+
+/*
+int32_t sleep(uint32_t ms)
+DESCRIPTION: blocks the calling process for a number of milliseconds
+INPUTS:
+	uint32_t ms - the time to sleep, rounded up to whole timer ticks
+OUTPUTS: none
+RETURN VALUE: 0
+SIDE EFFECTS: other processes run in the meantime
+*/
+int32_t sleep (uint32_t ms){
+    if(ms > 0)
+        timer_sleep(ms_to_ticks(ms));
+
+    return 0;
+}
+
+/*
+int32_t poll(pollfd_t* fds, int32_t nfds, int32_t timeout)
+DESCRIPTION: waits until one of several files is ready to be read or
+	written, or until a timeout runs out
+INPUTS:
+	pollfd_t* fds - the files to wait on and the POLL* events wanted for each,
+		entries with a negative fd are skipped
+	int32_t nfds - number of entries in fds
+	int32_t timeout - milliseconds to wait, 0 to only check, negative to
+		wait without a timeout
+OUTPUTS:
+	the revents of each entry are set to its ready events
+RETURN VALUE:
+	-number of entries with ready events, 0 if the timeout ran out
+	- -1 on invalid arguments
+SIDE EFFECTS: other processes run while the caller waits
+*/
+int32_t poll (pollfd_t* fds, int32_t nfds, int32_t timeout){
+    pcb_t * pcb;
+    poll_table_t table, * wait;
+    poll_timeout_t expiry;
+    timer_t timer;
+    uint32_t flags;
+    int32_t ready;
+
+    if(fds == NULL || nfds < 0 || nfds > FILE_ARRAY_LEN) return -1;
+
+    /* the whole array must lie in the program's page */
+    if(((uint32_t) fds < PROG_VM_START) ||
+            ((uint32_t) fds >= PROG_VM_START + SPACE_4MB) ||
+            ((uint32_t) (fds + nfds) > PROG_VM_START + SPACE_4MB))
+        return -1;
+
+    pcb(pcb);
+
+    poll_init(&table);
+    expiry.expired = (timeout == 0);
+    init_wait_queue(&expiry.wait);
+    timer_setup(&timer, poll_expire, &expiry);
+
+    cli_and_save(flags);
+
+    if(timeout > 0) {
+        poll_wait(&table, &expiry.wait);
+        timer_add(&timer, ms_to_ticks(timeout), 0);
+    }
+
+    /* the process gets on the wait queues of the files on the first check
+     * and stays there, so any of them can wake it */
+    wait = &table;
+    while(!(ready = poll_files(pcb, fds, nfds, wait)) && !expiry.expired) {
+        wait = NULL;
+        pcb -> state = PROC_BLOCKED;
+        schedule();
+    }
+
+    timer_del(&timer);
+    poll_free(&table);
+
+    restore_flags(flags);
+
+    return ready;
+}
+
+/*
+int32_t poll_files(pcb_t * pcb, pollfd_t* fds, int32_t nfds, poll_table_t * table)
+DESCRIPTION: sets the ready events of every entry of a poll
+INPUTS:
+	pcb_t * pcb - the polling process
+	pollfd_t* fds - the entries
+	int32_t nfds - number of entries
+	poll_table_t * table - poll table the files add their wait queues to, or NULL
+OUTPUTS: the revents of the entries
+RETURN VALUE: number of entries with ready events
+SIDE EFFECTS: none
+*/
+static int32_t poll_files (pcb_t * pcb, pollfd_t* fds, int32_t nfds, poll_table_t * table){
+    int32_t i, fd, revents, ready = 0;
+    fd_t * file;
+
+    for(i = 0; i < nfds; i++) {
+        fd = fds[i].fd;
+        if(fd < 0) {
+            revents = 0;
+        } else if(fd >= FILE_ARRAY_LEN || !(pcb -> files[fd].flags & FD_LIVE)) {
+            revents = POLLNVAL;
+        } else {
+            file = &(pcb -> files[fd]);
+            if(file -> fops -> poll != NULL)
+                revents = file -> fops -> poll(fd, table);
+            else
+                revents = POLLIN | POLLOUT;
+            revents &= fds[i].events | POLLNVAL;
+        }
+
+        fds[i].revents = revents;
+        if(revents) ready++;
+    }
+
+    return ready;
+}
+
+/*
+void poll_expire(void * data)
+DESCRIPTION: timer callback that ends a poll
+INPUTS: void * data - the poll's timeout
+OUTPUTS: none
+RETURN VALUE: none
+SIDE EFFECTS: wakes up the polling process
+*/
+static void poll_expire (void * data){
+    poll_timeout_t * expiry = (poll_timeout_t *) data;
+
+    expiry -> expired = 1;
+    wake_up(&expiry -> wait);
+}
+
+/*
+int32_t ioctl(int32_t fd, int32_t cmd, int32_t arg)
+DESCRIPTION: changes how an open file behaves. IOCTL_NONBLOCK works on any
+	file, other commands are passed to the file's device
+INPUTS:
+	int32_t fd - the file descriptor
+	int32_t cmd - one of the IOCTL_* commands
+	int32_t arg - argument of the command
+OUTPUTS: none
+RETURN VALUE:
+	0 on success
+	-1 on failure (fd not open, or the device does not know the command)
+SIDE EFFECTS: none
+*/
+int32_t ioctl (int32_t fd, int32_t cmd, int32_t arg){
+    pcb_t * pcb;
+    fd_t * file;
+
+    if(fd < 0 || fd >= FILE_ARRAY_LEN) return -1;
+
+    pcb(pcb);
+    file = &(pcb -> files[fd]);
+    if(!(file -> flags & FD_LIVE)) return -1;
+
+    if(cmd == IOCTL_NONBLOCK) {
+        if(arg) file -> flags |= FD_NONBLOCK;
+        else file -> flags &= ~FD_NONBLOCK;
+        return 0;
+    }
+
+    if(file -> fops -> ioctl == NULL) return -1;
+    return file -> fops -> ioctl(fd, cmd, arg);
+}
+
 /* taken from given syscall material for now */
 /*
 void parse_arg(const uint8_t* command, uint8_t* command_buf, uint8_t* arg_buf)
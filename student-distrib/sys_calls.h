@@ -2,11 +2,19 @@
 #define _SYS_CALLS_H
 
 #include "types.h"
+#include "sched.h"
 
 #define KERNEL_MEM_END 	 	0x800000
 #define KERNEL_STACK_SIZE   0x2000
 
-/* 10 system calls */
+/* an entry of a poll, events and revents hold POLL* bits */
+typedef struct pollfd {
+    int32_t fd;
+    int16_t events;
+    int16_t revents;
+} pollfd_t;
+
+/* 14 system calls */
 
 //terminates the execution of a file
 int32_t halt (uint8_t status);
@@ -14,6 +22,9 @@ int32_t halt (uint8_t status);
 //executes the command inputted from the command line
 int32_t execute (const uint8_t* command);
 
+//runs a program with no parent process on terminal 'term_num'
+int32_t execute_on_terminal (const uint8_t* command, int32_t term_num);
+
 //reads nbytes from the file/evice  described by the file descriptor at the index fd into buf
 int32_t read (int32_t fd, void* buf, int32_t nbytes);
 
@@ -36,4 +47,16 @@ int32_t vidmap (uint8_t** screen_start);
 int32_t set_handler (int32_t signum, void* handler_address);
 int32_t sigreturn (void);
 
+//changes the scheduling priority of the calling process
+int32_t nice (int32_t inc);
+
+//blocks the calling process for 'ms' milliseconds
+int32_t sleep (uint32_t ms);
+
+//waits until one of several files is ready or 'timeout' milliseconds pass
+int32_t poll (pollfd_t* fds, int32_t nfds, int32_t timeout);
+
+//changes how a file behaves, see the IOCTL_* commands in fs.h
+int32_t ioctl (int32_t fd, int32_t cmd, int32_t arg);
+
 #endif /* _SYS_CALLS_H */
@@ -0,0 +1,351 @@
+/* timer.c - Hierarchical timer wheel driven by the PIT tick
+ * vim:ts=4 noexpandtab
+ */
+
+#include "timer.h"
+#include "lib.h"
+#include "sched.h"
+#include "devices/pit.h"
+
+/* four levels of 64 slots. Level 0 holds the timers due in the next 64
+ * ticks one slot per tick, each higher level covers 64 times the range of
+ * the one below and is cascaded down when the level below wraps. */
+#define WHEEL_BITS		6
+#define WHEEL_SIZE		(1 << WHEEL_BITS)
+#define WHEEL_MASK		(WHEEL_SIZE - 1)
+#define WHEEL_LEVELS	4
+#define MAX_TIMEOUT		((1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+#define MS_PER_SEC		1000
+
+/* slot of tick 'x' on a level */
+#define WHEEL_IDX(x, level)	(((x) >> ((level) * WHEEL_BITS)) & WHEEL_MASK)
+
+/* a process sleeping on a timer */
+typedef struct sleeper {
+	int32_t done;
+	wait_queue_t wait;
+} sleeper_t;
+
+static void internal_add(timer_t * timer);
+static void list_add(timer_t ** slot, timer_t * timer);
+static void list_del(timer_t * timer);
+static void cascade(int32_t level);
+static void sleep_done(void * data);
+
+static timer_t * wheel[WHEEL_LEVELS][WHEEL_SIZE];
+/* the next tick to be processed */
+static uint32_t next_tick = 0;
+static uint32_t num_pending = 0;
+
+/*
+ * void timer_init
+ *   Description: Initializes an empty timer wheel.
+ *   Inputs: none
+ *   Outputs: none
+ *   Return Value: none
+ */
+void timer_init() {
+	int32_t i, j;
+
+	for(i = 0; i < WHEEL_LEVELS; i++) {
+		for(j = 0; j < WHEEL_SIZE; j++)
+			wheel[i][j] = NULL;
+	}
+	next_tick = 0;
+	num_pending = 0;
+}
+
+/*
+ * void timer_setup
+ *   Description: Prepares a timer that is not running.
+ *   Inputs: timer - the timer
+ *           func - the callback to run when the timer is due
+ *           data - argument for the callback
+ *   Outputs: none
+ *   Return Value: none
+ */
+void timer_setup(timer_t * timer, void (*func)(void * data), void * data) {
+	timer -> func = func;
+	timer -> data = data;
+	timer -> period = 0;
+	timer -> slot = NULL;
+	timer -> prev = NULL;
+	timer -> next = NULL;
+}
+
+/*
+ * void timer_add
+ *   Description: Starts a timer, restarting it if it is already running.
+ *   Inputs: timer - the timer
+ *           ticks - ticks until the timer is due, at least 1
+ *           period - ticks between later runs, 0 to run once
+ *   Outputs: none
+ *   Return Value: none
+ */
+void timer_add(timer_t * timer, uint32_t ticks, uint32_t period) {
+	uint32_t flags;
+
+	if(ticks == 0) ticks = 1;
+	if(ticks > MAX_TIMEOUT) ticks = MAX_TIMEOUT;
+
+	cli_and_save(flags);
+
+	if(timer -> slot != NULL) list_del(timer);
+
+	/* next_tick has not happened yet, so it is 1 tick away */
+	timer -> expires = next_tick + ticks - 1;
+	timer -> period = period;
+	internal_add(timer);
+
+	restore_flags(flags);
+}
+
+/*
+ * void timer_del
+ *   Description: Stops a timer. Does nothing if it is not running.
+ *   Inputs: timer - the timer
+ *   Outputs: none
+ *   Return Value: none
+ */
+void timer_del(timer_t * timer) {
+	uint32_t flags;
+
+	cli_and_save(flags);
+
+	if(timer -> slot != NULL) list_del(timer);
+
+	restore_flags(flags);
+}
+
+/*
+ * int32_t timer_pending
+ *   Description: Tells whether a timer is running.
+ *   Inputs: timer - the timer
+ *   Outputs: none
+ *   Return Value: 1 if the timer is on the wheel, 0 otherwise
+ */
+int32_t timer_pending(timer_t * timer) {
+	return timer -> slot != NULL;
+}
+
+/*
+ * void timer_tick
+ *   Description: Processes one tick: cascades the higher levels when level
+ *           0 wraps, then runs the timers in the slot of the tick. Periodic
+ *           timers are put back on the wheel before their callback runs.
+ *   Inputs: none
+ *   Outputs: none
+ *   Return Value: none
+ */
+void timer_tick() {
+	timer_t * timer, * work;
+	uint32_t idx, flags;
+
+	cli_and_save(flags);
+
+	idx = WHEEL_IDX(next_tick, 0);
+	if(idx == 0) cascade(1);
+
+	/* take the due timers off the wheel first, so timers the callbacks
+	 * start for the next tick don't end up in this slot */
+	work = wheel[0][idx];
+	wheel[0][idx] = NULL;
+	for(timer = work; timer != NULL; timer = timer -> next)
+		timer -> slot = &work;
+
+	next_tick++;
+
+	while((timer = work) != NULL) {
+		list_del(timer);
+
+		if(timer -> period) {
+			timer -> expires += timer -> period;
+			internal_add(timer);
+		}
+
+		timer -> func(timer -> data);
+	}
+
+	restore_flags(flags);
+}
+
+/*
+ * uint32_t timer_next_deadline
+ *   Description: Looks ahead on level 0 for the next due timer. Timers on
+ *           the higher levels are only known to be due after the next
+ *           cascade, so that is reported if level 0 has nothing sooner.
+ *   Inputs: none
+ *   Outputs: none
+ *   Return Value: ticks until the next timer may be due, 0 if none is pending
+ */
+uint32_t timer_next_deadline() {
+	uint32_t i, idx;
+
+	if(!num_pending) return 0;
+
+	for(i = 0; i < WHEEL_SIZE; i++) {
+		idx = WHEEL_IDX(next_tick + i, 0);
+		if(idx == 0 || wheel[0][idx] != NULL)
+			break;
+	}
+	return i + 1;
+}
+
+/*
+ * uint32_t timer_get_ticks
+ *   Description: Returns the number of ticks processed since boot.
+ *   Inputs: none
+ *   Outputs: none
+ *   Return Value: the tick count
+ */
+uint32_t timer_get_ticks() {
+	return next_tick;
+}
+
+/*
+ * uint32_t ms_to_ticks
+ *   Description: Converts a time in milliseconds to timer ticks.
+ *   Inputs: ms - the time in milliseconds
+ *   Outputs: none
+ *   Return Value: the number of ticks, rounded up
+ */
+uint32_t ms_to_ticks(uint32_t ms) {
+	uint32_t hz = pit_get_rate();
+
+	return ms / MS_PER_SEC * hz + ((ms % MS_PER_SEC) * hz + MS_PER_SEC - 1) / MS_PER_SEC;
+}
+
+/*
+ * void timer_sleep
+ *   Description: Blocks the current process until a one-shot timer runs out.
+ *   Inputs: ticks - the least number of ticks to sleep
+ *   Outputs: none
+ *   Return Value: none
+ */
+void timer_sleep(uint32_t ticks) {
+	sleeper_t sleeper;
+	timer_t timer;
+	uint32_t flags;
+
+	sleeper.done = 0;
+	init_wait_queue(&sleeper.wait);
+	timer_setup(&timer, sleep_done, &sleeper);
+
+	/* the tick in progress is partly over already, so wait one more to
+	 * sleep at least 'ticks' whole ticks */
+	if(ticks < MAX_TIMEOUT) ticks++;
+
+	cli_and_save(flags);
+
+	timer_add(&timer, ticks, 0);
+	while(!sleeper.done)
+		sleep_on(&sleeper.wait);
+
+	restore_flags(flags);
+}
+
+/*
+ * void sleep_done
+ *   Description: Timer callback that wakes up a sleeping process.
+ *   Inputs: data - the sleeper
+ *   Outputs: none
+ *   Return Value: none
+ */
+static void sleep_done(void * data) {
+	sleeper_t * sleeper = (sleeper_t *) data;
+
+	sleeper -> done = 1;
+	wake_up(&sleeper -> wait);
+}
+
+/*
+ * void internal_add
+ *   Description: Puts a timer in the slot for its expiry tick, on the
+ *           lowest level whose range reaches it. Timers that are already
+ *           due go in the slot of the next tick.
+ *   Inputs: timer - the timer
+ *   Outputs: none
+ *   Return Value: none
+ */
+static void internal_add(timer_t * timer) {
+	uint32_t delta, expires = timer -> expires;
+	int32_t level;
+
+	delta = expires - next_tick;
+	if((int32_t) delta < 0) {
+		expires = next_tick;
+		delta = 0;
+	}
+
+	for(level = 0; level < WHEEL_LEVELS - 1; level++) {
+		if(delta < (1U << ((level + 1) * WHEEL_BITS)))
+			break;
+	}
+
+	list_add(&wheel[level][WHEEL_IDX(expires, level)], timer);
+	num_pending++;
+}
+
+/*
+ * void list_add
+ *   Description: Puts a timer at the head of a list.
+ *   Inputs: slot - the list
+ *           timer - the timer
+ *   Outputs: none
+ *   Return Value: none
+ */
+static void list_add(timer_t ** slot, timer_t * timer) {
+	timer -> slot = slot;
+	timer -> prev = NULL;
+	timer -> next = *slot;
+	if(*slot != NULL) (*slot) -> prev = timer;
+	*slot = timer;
+}
+
+/*
+ * void list_del
+ *   Description: Takes a timer off the list it is on.
+ *   Inputs: timer - the pending timer
+ *   Outputs: none
+ *   Return Value: none
+ */
+static void list_del(timer_t * timer) {
+	if(timer -> prev != NULL) timer -> prev -> next = timer -> next;
+	else *(timer -> slot) = timer -> next;
+	if(timer -> next != NULL) timer -> next -> prev = timer -> prev;
+
+	timer -> slot = NULL;
+	timer -> prev = NULL;
+	timer -> next = NULL;
+	num_pending--;
+}
+
+/*
+ * void cascade
+ *   Description: Moves the timers of the current slot of a level down to
+ *           the levels below, and cascades the next level as well when
+ *           this level wraps.
+ *   Inputs: level - the level to cascade, at least 1
+ *   Outputs: none
+ *   Return Value: none
+ */
+static void cascade(int32_t level) {
+	timer_t * timer, * next;
+	uint32_t idx;
+
+	if(level >= WHEEL_LEVELS) return;
+
+	idx = WHEEL_IDX(next_tick, level);
+	if(idx == 0) cascade(level + 1);
+
+	timer = wheel[level][idx];
+	wheel[level][idx] = NULL;
+
+	while(timer != NULL) {
+		next = timer -> next;
+		num_pending--;
+		internal_add(timer);
+		timer = next;
+	}
+}
@@ -0,0 +1,52 @@
+/* timer.h - Defines for the kernel timers
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include "types.h"
+
+/* a kernel timer. Callbacks run in the timer interrupt with interrupts
+ * disabled, so they must not sleep. */
+typedef struct timer {
+	uint32_t expires;				/* tick the timer runs at */
+	uint32_t period;				/* ticks between runs, 0 for a one-shot */
+	void (*func)(void * data);
+	void * data;
+	struct timer ** slot;			/* list the timer is on, NULL if not running */
+	struct timer * prev;
+	struct timer * next;
+} timer_t;
+
+/* set up the timer wheel */
+void timer_init();
+
+/* prepare a timer to call 'func' with 'data' */
+void timer_setup(timer_t * timer, void (*func)(void * data), void * data);
+
+/* start a timer 'ticks' from now, repeating every 'period' ticks if not 0 */
+void timer_add(timer_t * timer, uint32_t ticks, uint32_t period);
+
+/* stop a timer */
+void timer_del(timer_t * timer);
+
+/* whether a timer is running */
+int32_t timer_pending(timer_t * timer);
+
+/* advance the wheel by one tick and run the timers that are due */
+void timer_tick();
+
+/* ticks until the next timer may be due, 0 if no timer is pending */
+uint32_t timer_next_deadline();
+
+/* ticks since the wheel was set up */
+uint32_t timer_get_ticks();
+
+/* convert milliseconds to ticks, rounding up */
+uint32_t ms_to_ticks(uint32_t ms);
+
+/* block the current process for at least 'ticks' ticks */
+void timer_sleep(uint32_t ticks);
+
+#endif /* _TIMER_H */
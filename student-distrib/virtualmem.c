@@ -1,6 +1,8 @@
 #include "virtualmem.h"
 #include "lib.h"
 #include "process.h"
+#include "physmem.h"
+#include "slab.h"
 #include "devices/keyboard.h"
 
 /* values for manipulating table entries */
@@ -10,6 +12,7 @@
 #define PDE_4MB_MASK 0xFFC00000
 #define PDE_4KB_MASK 0xFFFFF000
 #define FLAGS_MASK	 0xFFF
+#define PDE_4MB_SIZE 0x400000
 
 /* initial values */
 #define LARGE_INIT_FLAGS (FLAG_P | FLAG_WE | FLAG_PS)
@@ -19,10 +22,14 @@
 
 static uint32_t pd_first[TABLE_SIZE] __attribute__((aligned (PAGE_SIZE)));
 
-/* 0 - vidmem; 1 - term 0 back; 2 - term 1 back; 3 - term 2 back */
-static uint32_t pt_vidmem[MAX_TERMINALS][TABLE_SIZE] __attribute__((aligned (PAGE_SIZE)));
+/* the VGA memory for the kernel, and the screen of each terminal for its
+   vidmap programs */
+static uint32_t pt_vidmem[TABLE_SIZE] __attribute__((aligned (PAGE_SIZE)));
 static uint32_t pt_user_vidmem[MAX_TERMINALS][TABLE_SIZE] __attribute__((aligned (PAGE_SIZE)));
 
+/* page directories and page tables of processes */
+static slab_cache_t table_cache;
+
 /*
  * void virtualmem_init
  *   Description: Initialize the initial page directory and page tables used
@@ -35,37 +42,35 @@ void virtualmem_init()
 {
 	int i, j;
 
+	slab_cache_init(&table_cache, "page table", PAGE_SIZE, PAGE_SIZE);
+
 	/* initialize first page directory */
 	pd_init(pd_first, 0);
 
 	/* initialize page tables */
-	for(i = 0; i < MAX_TERMINALS; i++) {
-		for(j = 0; j < TABLE_SIZE; j++) {
-			pt_vidmem[i][j] = 0;
+	for(j = 0; j < TABLE_SIZE; j++) {
+		pt_vidmem[j] = 0;
+		for(i = 0; i < MAX_TERMINALS; i++)
 			pt_user_vidmem[i][j] = 0;
-		}
 	}
 
-	for(i = 0; i < MAX_TERMINALS; i++) {
-		pt_vidmem[i][VIDEO >> PTE_IDX_OFFS & PTE_IDX_MASK] = (VIDEO + i * PAGE_SIZE) | FLAG_WE | FLAG_P;
-		for(j = 0; j < MAX_TERMINALS; j++) {
-			pt_vidmem[i][(VIDEO + (j + 1) * PAGE_SIZE) >> PTE_IDX_OFFS & PTE_IDX_MASK] = (VIDEO + j * PAGE_SIZE) | FLAG_WE | FLAG_P;
-		}
-		pt_user_vidmem[i][PROG_VIDMEM_ADDR >> PTE_IDX_OFFS & PTE_IDX_MASK] = (VIDEO + i * PAGE_SIZE) | FLAG_WE | FLAG_U | FLAG_P;
-	}
+	/* all of the VGA memory is mapped, the display scrolls through it */
+	for(j = 0; j < VIDEO_SIZE; j += PAGE_SIZE)
+		set_pte(pt_vidmem, VIDEO + j, VIDEO + j, FLAG_WE | FLAG_P);
 
 	set_pd(pd_first);
 
 	/* enable PSE for 4 MB pages
 	   0x10 - enable 4th bit of cr4 */
-	/* turn on paging
-	   0x80000000 - enable paging bit of cr0 */
+	/* turn on paging and write protection in the kernel, so kernel
+	   writes to copy-on-write user pages fault as well
+	   0x80010000 - enable paging and WP bits of cr0 */
 	asm volatile("					\n\
 		movl	%%cr4, %%eax		\n\
 		orl		$0x10, %%eax		\n\
 		movl	%%eax, %%cr4		\n\
 		movl	%%cr0, %%eax		\n\
-		orl		$0x80000000, %%eax	\n\
+		orl		$0x80010000, %%eax	\n\
 		movl	%%eax, %%cr0		\n\
 		"
 		:
@@ -83,7 +88,7 @@ void virtualmem_init()
  *   Return Value: none
  */
 void pd_init(uint32_t * pd, int32_t term_num) {
-	int i;
+	uint32_t i;
 
 	/* initialize page directory */
 	for(i = 0; i < TABLE_SIZE; i++)
@@ -92,11 +97,29 @@ void pd_init(uint32_t * pd, int32_t term_num) {
 	}
 
 	/* initialize video memory pages */
-	pd[0] = (uint32_t) pt_vidmem[term_num] | FLAG_WE | FLAG_P;
+	pd[0] = (uint32_t) pt_vidmem | FLAG_WE | FLAG_P;
 	pd[PROG_VIDMEM_ADDR >> PDE_IDX_OFFS] = (uint32_t) pt_user_vidmem[term_num] | FLAG_WE | FLAG_U;
 
 	/* initialize 4 MB kernel page */
 	set_pde(pd, KERNEL_LOC, KERNEL_LOC, LARGE_INIT_FLAGS);
+
+	/* map the frame allocator's memory 1:1 so the kernel can fill frames */
+	for(i = PHYS_MAP_START; i < PHYS_MAP_END; i += PDE_4MB_SIZE) {
+		set_pde(pd, i, i, LARGE_INIT_FLAGS);
+	}
+}
+
+/*
+ * void map_user_vidmem
+ *   Description: Sets the page vidmap programs on a terminal see as video
+ *           memory.
+ *   Inputs: term_num - the terminal
+ *           addr - the page aligned screen of the terminal
+ *   Outputs: none
+ *   Return Value: none
+ */
+void map_user_vidmem(int32_t term_num, uint32_t addr) {
+	set_pte(pt_user_vidmem[term_num], PROG_VIDMEM_ADDR, addr, FLAG_WE | FLAG_U | FLAG_P);
 }
 
 /*
@@ -163,3 +186,134 @@ void set_pd(uint32_t * pd) {
 		: "rm" (pd)
 	);
 }
+
+/*
+ * void set_pte
+ *   Description: Sets an entry in the given page table.
+ *   Inputs: pt - a pointer to a page table
+ *           virtual_addr - a virtual address to set the PTE for
+ *           physical_addr - the physical address to map the virtual address to
+ *           flags - the flags to set in the PTE
+ *   Outputs: none
+ *   Return Value: none
+ */
+void set_pte(uint32_t * pt, uint32_t virtual_addr, uint32_t physical_addr, uint32_t flags) {
+	pt[virtual_addr >> PTE_IDX_OFFS & PTE_IDX_MASK] = (physical_addr & PDE_4KB_MASK) | flags;
+}
+
+/*
+ * uint32_t * table_alloc
+ *   Description: Allocates a page directory or page table for a process.
+ *           The table is not cleared.
+ *   Inputs: none
+ *   Outputs: none
+ *   Return Value: pointer to the table, NULL if memory is exhausted
+ */
+uint32_t * table_alloc() {
+	return slab_alloc(&table_cache);
+}
+
+/*
+ * void user_mem_free
+ *   Description: Gives back every frame of a process' address space: the
+ *           private pages of the user program region, and returns its page
+ *           table and page directory to their cache. Pages shared with the
+ *           filesystem are left alone. Must not be called on the active
+ *           page directory.
+ *   Inputs: pd - the process' page directory
+ *           pt - the process' user page table
+ *   Outputs: none
+ *   Return Value: none
+ */
+void user_mem_free(uint32_t * pd, uint32_t * pt) {
+	int i;
+
+	if(pt != NULL) {
+		for(i = 0; i < TABLE_SIZE; i++) {
+			if((pt[i] & FLAG_P) && !(pt[i] & FLAG_COW))
+				free_frame(pt[i] & PDE_4KB_MASK);
+		}
+		slab_free(&table_cache, pt);
+	}
+	slab_free(&table_cache, pd);
+}
+
+/*
+ * int32_t map_private_page
+ *   Description: Maps a page of the user program region writable onto a
+ *           newly allocated frame owned by the process.
+ *   Inputs: pte - the PTE of the page
+ *           page - the page aligned user address
+ *   Outputs: none
+ *   Return Value: 0 on success, -1 if there are no free frames
+ */
+static int32_t map_private_page(uint32_t * pte, uint32_t page) {
+	uint32_t frame = alloc_frame();
+
+	if(!frame) return -1;
+
+	*pte = frame | FLAG_U | FLAG_WE | FLAG_P;
+	invlpg(page);
+	return 0;
+}
+
+/*
+ * int32_t user_page_fault
+ *   Description: Resolves page faults in the user program region. Missing
+ *           pages of the executable are faulted in from the file (shared
+ *           read-only with the filesystem when possible), other missing
+ *           pages (stack, bss) are zero filled, and writes to copy-on-write
+ *           pages copy the shared page into a frame of the process' own.
+ *   Inputs: pcb - the faulting process
+ *           addr - the faulting address (cr2)
+ *           err - the page fault error code
+ *   Outputs: none
+ *   Return Value: 0 if the fault was handled, -1 otherwise (including
+ *           running out of frames)
+ */
+int32_t user_page_fault(pcb_t * pcb, uint32_t addr, uint32_t err) {
+	uint32_t page, offs, bytes, * pte;
+	data_block_t * block;
+
+	if(pcb -> pt == NULL || addr < PROG_VM_START || addr >= PROG_VM_START + SPACE_4MB)
+		return -1;
+
+	page = addr & PDE_4KB_MASK;
+	pte = &(pcb -> pt[page >> PTE_IDX_OFFS & PTE_IDX_MASK]);
+
+	if(err & PF_PRESENT) {
+		/* only writes to copy-on-write pages are expected on present pages */
+		if(!(err & PF_WRITE) || !(*pte & FLAG_COW))
+			return -1;
+
+		/* the shared page is a filesystem block, which the kernel page maps 1:1 */
+		block = (data_block_t *) (*pte & PDE_4KB_MASK);
+		if(map_private_page(pte, page)) return -1;
+		memcpy((void *) page, block, PAGE_SIZE);
+		return 0;
+	}
+
+	offs = page - START_EXE_ADDR;
+	if(page >= START_EXE_ADDR && offs < pcb -> image_len) {
+		/* full blocks of the executable are shared until they are written */
+		if(!(err & PF_WRITE) && pcb -> image_len - offs >= PAGE_SIZE) {
+			block = get_file_page(pcb -> image_inode, offs);
+			if(block != NULL) {
+				*pte = (uint32_t) block | FLAG_COW | FLAG_U | FLAG_P;
+				invlpg(page);
+				return 0;
+			}
+		}
+
+		/* otherwise read the file into the process' page, zeroing the tail */
+		if(map_private_page(pte, page)) return -1;
+		bytes = read_data(pcb -> image_inode, offs, (uint8_t *) page, PAGE_SIZE);
+		memset((uint8_t *) page + bytes, 0, PAGE_SIZE - bytes);
+		return 0;
+	}
+
+	/* stack and bss pages start out zeroed */
+	if(map_private_page(pte, page)) return -1;
+	memset((void *) page, 0, PAGE_SIZE);
+	return 0;
+}
@@ -2,6 +2,7 @@
 #define _VIRTUALMEM_H_
 
 #include "types.h"
+#include "process.h"
 
 #define TABLE_SIZE 1024
 #define PAGE_SIZE  4096  /* kilobytes */
@@ -16,6 +17,12 @@
 #define FLAG_D  0x40   /* dirty */
 #define FLAG_PS 0x80   /* page size (4 MB) */
 #define FLAG_G  0x100  /* global */
+#define FLAG_COW 0x200 /* available bit: copy page on first write */
+
+/* page fault error code bits */
+#define PF_PRESENT 0x1  /* fault on a present page */
+#define PF_WRITE   0x2  /* fault caused by a write */
+#define PF_USER    0x4  /* fault happened in user mode */
 
 /* flush the tlb without changing it */
 #define flush_tlb()						\
@@ -30,9 +37,30 @@
 	);									\
 }
 
+/* flush a single page from the tlb */
+#define invlpg(addr)					\
+{										\
+	asm volatile("invlpg (%0)"			\
+		:								\
+		: "r" (addr)					\
+		: "memory"						\
+	);									\
+}
+
+/* get the faulting address of a page fault */
+#define get_cr2(x)						\
+{										\
+	asm volatile("movl %%cr2, %0"		\
+		: "=r" (x)						\
+	);									\
+}
+
 /* initializes the paging for virtual mem */
 void virtualmem_init();
 
+/* map a terminal's screen at the vidmap address of its processes */
+void map_user_vidmem(int32_t term_num, uint32_t addr);
+
 /* generalized paging functions */
 /* initialize a page directory to default values */
 void pd_init(uint32_t * pd, int32_t term_num);
@@ -44,5 +72,13 @@ void set_pde_flags(uint32_t * pd, uint32_t virtual_addr, uint32_t flags);
 void unset_pde_flags(uint32_t * pd, uint32_t virtual_addr, uint32_t flags);
 /* set the PDPR to a page directory */
 void set_pd(uint32_t * pd);
+/* set a page table entry */
+void set_pte(uint32_t * pt, uint32_t virtual_addr, uint32_t physical_addr, uint32_t flags);
+/* allocate a page directory or page table for a process */
+uint32_t * table_alloc();
+/* free the frames of a process' address space */
+void user_mem_free(uint32_t * pd, uint32_t * pt);
+/* resolve a page fault in the user program region, 0 if handled */
+int32_t user_page_fault(pcb_t * pcb, uint32_t addr, uint32_t err);
 
 #endif
@@ -186,6 +186,15 @@ do {                                    \
 			: "memory", "cc" );         \
 } while(0)
 
+/* Write a 32-bit value to a model specific register */
+#define wrmsr(msr, val)                 \
+do {                                    \
+	asm volatile("wrmsr"                \
+			:                           \
+			: "c" (msr), "a" (val), "d" (0) \
+			: "memory");                \
+} while(0)
+
 /* Load the interrupt descriptor table (IDT).  This macro takes a 32-bit
  * address which points to a 6-byte structure.  The 6-byte structure
  * (defined as "struct x86_desc" above) contains a 2-byte size field
@@ -0,0 +1,57 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define ROUNDS      8
+#define CALLS_SHIFT 14
+#define CALLS       (1 << CALLS_SHIFT)
+
+static uint64_t
+rdtsc ()
+{
+    uint64_t tsc;
+
+    asm volatile ("rdtsc" : "=A" (tsc));
+    return tsc;
+}
+
+/* Average cycles of a call in the fastest of several rounds, so rounds
+   that were interrupted by the timer or another program don't count.
+   nice(0) changes nothing, so it measures the cost of entering and
+   leaving the kernel. */
+static uint32_t
+measure (int32_t (*call)(int32_t))
+{
+    uint64_t start, cycles;
+    uint32_t i, round, best = 0xFFFFFFFF;
+
+    for (round = 0; round < ROUNDS; round++) {
+        start = rdtsc();
+        for (i = 0; i < CALLS; i++)
+            call(0);
+        cycles = (rdtsc() - start) >> CALLS_SHIFT;
+        if (cycles < best)
+            best = cycles;
+    }
+    return best;
+}
+
+static void
+report (const uint8_t* name, uint32_t cycles)
+{
+    uint8_t buf[12];
+
+    ece391_fdputs(1, name);
+    ece391_itoa(cycles, buf, 10);
+    ece391_fdputs(1, buf);
+    ece391_fdputs(1, (uint8_t*)" cycles per null system call\n");
+}
+
+int main ()
+{
+    report((uint8_t*)"int $0x80: ", measure(ece391_nice));
+    report((uint8_t*)"sysenter:  ", measure(ece391_fast_nice));
+
+    return 0;
+}
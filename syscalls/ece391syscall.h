@@ -5,6 +5,31 @@
 
 /* All calls return >= 0 on success or -1 on failure. */
 
+/* poll events */
+#define POLLIN   0x1
+#define POLLOUT  0x4
+#define POLLNVAL 0x20
+
+/* an fd to poll and the events wanted, revents gets the ready ones */
+struct ece391_pollfd {
+    int32_t fd;
+    int16_t events;
+    int16_t revents;
+};
+
+/* ioctl commands */
+#define IOCTL_NONBLOCK  1  /* arg 1 makes reads on the fd return at once */
+#define IOCTL_TERM_MODE 2  /* arg TERM_COOKED or TERM_RAW */
+#define IOCTL_KEYMAP    3  /* arg one of the keyboard layouts below */
+
+/* terminal modes */
+#define TERM_COOKED 0  /* reads return whole lines */
+#define TERM_RAW    1  /* reads return keys as they are pressed */
+
+/* keyboard layouts */
+#define KEYMAP_US     0
+#define KEYMAP_DVORAK 1
+
 /*  
  * Note that the system call for halt will have to make sure that only
  * the low byte of EBX (the status argument) is returned to the calling
@@ -21,6 +46,17 @@ extern int32_t ece391_getargs (uint8_t* buf, int32_t nbytes);
 extern int32_t ece391_vidmap (uint8_t** screen_start);
 extern int32_t ece391_set_handler (int32_t signum, void* handler);
 extern int32_t ece391_sigreturn (void);
+extern int32_t ece391_nice (int32_t inc);
+extern int32_t ece391_sleep (uint32_t ms);
+extern int32_t ece391_poll (struct ece391_pollfd* fds, int32_t nfds,
+			    int32_t timeout);
+extern int32_t ece391_ioctl (int32_t fd, int32_t cmd, int32_t arg);
+
+/* the same calls made with SYSENTER instead of INT $0x80. Unlike the INT
+   $0x80 calls they clobber ECX and EDX, which only matters to asm callers */
+extern int32_t ece391_fast_read (int32_t fd, void* buf, int32_t nbytes);
+extern int32_t ece391_fast_write (int32_t fd, const void* buf, int32_t nbytes);
+extern int32_t ece391_fast_nice (int32_t inc);
 
 enum signums {
 	DIV_ZERO = 0,